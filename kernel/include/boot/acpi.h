@@ -0,0 +1,102 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+#define ACPI_MAX_TABLES 32
+
+typedef struct acpi_rsdp1_t {
+    char signature[8]; // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} acpi_rsdp1_t __attribute__((packed));
+
+typedef struct acpi_rsdp2_t {
+    acpi_rsdp1_t rsdp1;
+    uint32_t length;
+    uint64_t xsdt_addr;
+    uint8_t checksum;
+    uint8_t reserved[3];
+} acpi_rsdp2_t __attribute__((packed));
+
+/* Common header of all system description tables */
+typedef struct acpi_sdt_header_t {
+    char signature[4];
+    uint32_t length; // Including the header
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} acpi_sdt_header_t __attribute__((packed));
+
+typedef struct acpi_gas_t {
+    uint8_t space_id; // 0 for system memory, 1 for system IO
+    uint8_t bit_width;
+    uint8_t bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+} acpi_gas_t __attribute__((packed));
+
+/* The Multiple APIC Description Table, signature "APIC". Variable length
+ * entries describing interrupt controllers follow it.
+ */
+typedef struct acpi_madt_t {
+    acpi_sdt_header_t header;
+    uint32_t lapic_addr; // Physical address of the local APICs
+    uint32_t flags;
+} acpi_madt_t __attribute__((packed));
+
+#define ACPI_MADT_LAPIC 0
+#define ACPI_MADT_IOAPIC 1
+#define ACPI_MADT_OVERRIDE 2
+
+typedef struct acpi_madt_entry_t {
+    uint8_t type;
+    uint8_t length;
+} acpi_madt_entry_t __attribute__((packed));
+
+#define ACPI_MADT_LAPIC_ENABLED 1
+#define ACPI_MADT_LAPIC_ONLINE_CAPABLE 2
+
+/* A processor and its local APIC */
+typedef struct acpi_madt_lapic_t {
+    acpi_madt_entry_t header;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} acpi_madt_lapic_t __attribute__((packed));
+
+/* An I/O APIC, handling the global system interrupts from `gsi_base` on */
+typedef struct acpi_madt_ioapic_t {
+    acpi_madt_entry_t header;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} acpi_madt_ioapic_t __attribute__((packed));
+
+#define ACPI_MADT_POLARITY_MASK 0x3
+#define ACPI_MADT_POLARITY_LOW 0x3
+#define ACPI_MADT_TRIGGER_MASK 0xC
+#define ACPI_MADT_TRIGGER_LEVEL 0xC
+
+/* An ISA interrupt that isn't wired to the global system interrupt of the same
+ * number, or not with the ISA polarity and trigger mode.
+ */
+typedef struct acpi_madt_override_t {
+    acpi_madt_entry_t header;
+    uint8_t bus;
+    uint8_t source; // ISA IRQ
+    uint32_t gsi;
+    uint16_t flags;
+} acpi_madt_override_t __attribute__((packed));
+
+typedef struct mb2_t mb2_t;
+
+void init_acpi(mb2_t* boot);
+acpi_sdt_header_t* acpi_find_table(const char* signature);
+acpi_madt_entry_t* acpi_madt_next(acpi_madt_t* madt, acpi_madt_entry_t* prev, uint8_t type);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "kernel/boot/multiboot2.h"
+
+#define CMDLINE_MAX 256
+
+void init_cmdline(mb2_t* boot);
+const char* cmdline_get(const char* key);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "kernel/boot/acpi.h"
 #include "libc/stdint.h"
 
 #define MB2_MAGIC 0x36D76289
@@ -88,22 +89,6 @@ typedef struct mb2_tag_fb_t {
     /* Color info stuff goes here, but it's tedious & useless */
 } mb2_tag_fb_t __attribute__((packed));
 
-/* TODO: reconsider moving those two once ACPI gets there */
-typedef struct acpi_rsdp1_t {
-    uint8_t checksum;
-    char oem_id[6];
-    uint8_t revision;
-    uint32_t rsdt_addr;
-} acpi_rsdp1_t __attribute__((packed));
-
-typedef struct acpi_rsdp2_t {
-    acpi_rsdp1_t rsdp1;
-    uint32_t length;
-    uint64_t xsdt_addr;
-    uint8_t checksum;
-    uint8_t reserved[3];
-} acpi_rsdp2_t __attribute__((packed));
-
 typedef struct mb2_tag_rsdp1_t {
     mb2_tag_t header;
     acpi_rsdp1_t rsdp;
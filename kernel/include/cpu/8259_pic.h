@@ -32,3 +32,25 @@ void pic8259_init();
  * This function signals to the PIC that the interrupt has been handled.
  */
 void pic8259_eoi(uint8_t irq);
+
+/**
+ * @brief Mask every line of both PICs.
+ *
+ * Used once interrupts are delivered through the I/O APIC instead.
+ */
+void pic8259_disable();
+
+/**
+ * @brief Get the mask of both PICs.
+ *
+ * @return One bit per IRQ line, set if the line is masked, the master's in the
+ * low byte.
+ */
+uint16_t pic8259_get_mask();
+
+/**
+ * @brief Set the mask of both PICs, as returned by `pic8259_get_mask`.
+ *
+ * @param mask One bit per IRQ line to mask.
+ */
+void pic8259_set_mask(uint16_t mask);
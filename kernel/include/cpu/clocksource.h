@@ -0,0 +1,27 @@
+#pragma once
+
+#include "kernel/cpu/timer.h"
+#include "libc/stdint.h"
+
+#define NS_PER_SEC 1000000000
+
+/* A free running counter the monotonic clock can be derived from. Cycles are
+ * converted to nanoseconds in fixed point: `ns = cycles * mult >> shift`.
+ */
+typedef struct clocksource_t {
+    const char* name;
+    uint64_t (*read)();
+    uint64_t mask; // The counter wraps around past this value
+    uint32_t rating; // The best rated clocksource is used
+    // Filled in by `clocksource_register`
+    uint32_t mult;
+    uint32_t shift;
+} clocksource_t;
+
+void init_clocksource();
+void clocksource_register(clocksource_t* cs, uint64_t freq);
+uint64_t clocksource_cycles_to_ns(clocksource_t* cs, uint64_t cycles);
+uint64_t clock_monotonic_ns();
+bool clock_is_jiffies();
+void clock_delay_ns(uint64_t ns);
+void clock_ns_to_timespec(uint64_t ns, timespec_t* ts);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "kernel/cpu/gdt.h"
+#include "kernel/cpu/tss.h"
+#include "kernel/sys/spinlock.h"
+#include "libc/stdint.h"
+
+#define CPU_MAX 16
+
+/* Selector of the per-CPU data segment, kept in %fs while in the kernel. Its
+ * base is the CPU's `cpu_t`, see `cpu_current`.
+ */
+#define CPU_SELECTOR 0x30
+
+struct _thread_t;
+struct _sched_t;
+
+/* Everything a processor owns. Each CPU has its own GDT, whose per-CPU data
+ * segment points to its `cpu_t`.
+ */
+typedef struct cpu_t {
+    struct cpu_t* self;                     // Must stay first, see `cpu_current`
+    struct _thread_t* current;              // At offset 4, used by `proc.asm`
+    uint32_t id;                            // Index in `cpus`
+    uint32_t apic_id;
+    volatile bool online;
+    // Run queue of this CPU, protected by `rq_lock`
+    struct _sched_t* scheduler;
+    spinlock_t rq_lock;
+    // Runs when the run queue is empty, see `proc_idle`
+    struct _thread_t* idle_thread;
+    uint64_t idle_ns;
+    uint64_t idle_start;
+    // Tick up to which the current thread was charged
+    uint32_t last_tick;
+    // Tick at which the timer callback must run at the latest, see `timer.c`
+    uint32_t timer_deadline;
+    bool timer_has_deadline;
+    // The thread whose state is loaded in this CPU's FPU, see `fpu.c`
+    struct _thread_t* fpu_owner;
+    // Preemption is off while positive, see `preempt.c`
+    uint32_t preempt_count;
+    // Set by interrupt handlers for the current thread to be preempted
+    volatile bool need_resched;
+    // Number of interrupt handlers running on top of each other, see `isr.c`
+    uint32_t irq_depth;
+    // Bit `n` is set while softirq `n` is pending, see `softirq.c`
+    uint32_t softirq_pending;
+    bool in_softirq;
+    tss_entry_t tss;
+    GDT gdt[NO_GDT_DESCRIPTORS];
+    GDT_PTR gdt_ptr;
+} cpu_t;
+
+extern cpu_t cpus[CPU_MAX];
+extern uint32_t cpu_count;
+
+cpu_t* cpu_current();
+void cpu_init(cpu_t* cpu);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+typedef struct {
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+} cpuid_t;
+
+// Leaf 1
+#define CPUID_EDX_TSC (1 << 4)
+#define CPUID_EDX_SEP (1 << 11)
+#define CPUID_ECX_MONITOR (1 << 3)
+#define CPUID_ECX_XSAVE (1 << 26)
+
+// Leaf 0xD, subleaf 1
+#define CPUID_XSAVE_EAX_XSAVEOPT (1 << 0)
+
+// Leaf 0x80000007
+#define CPUID_EXT_EDX_INVARIANT_TSC (1 << 8)
+
+cpuid_t cpuid(uint32_t leaf, uint32_t subleaf);
+bool cpuid_has_leaf(uint32_t leaf);
@@ -3,7 +3,24 @@
 #include "kernel/sys/proc.h"
 #include "libc/stdint.h"
 
+#define CR0_TS (1 << 3)
+#define CR4_OSXSAVE (1 << 18)
+
+// State components, as enabled in XCR0
+#define FPU_XCR0_X87 (1 << 0)
+#define FPU_XCR0_SSE (1 << 1)
+#define FPU_XCR0_AVX (1 << 2)
+#define FPU_XCR0_AVX512 (7 << 5) // Opmask, upper halves of ZMM0-15, ZMM16-31
+#define FPU_XCR0_USER (FPU_XCR0_X87 | FPU_XCR0_SSE | FPU_XCR0_AVX | FPU_XCR0_AVX512)
+
+// Initial values of the control registers, in the legacy area
+#define FPU_FCW_OFFSET 0
+#define FPU_FCW_DEFAULT 0x037F
+#define FPU_MXCSR_OFFSET 24
+#define FPU_MXCSR_DEFAULT 0x1F80
+
 void init_fpu();
-void fpu_switch(process_t* prev, const process_t* next);
-void fpu_kernel_enter();
-void fpu_kernel_exit();
\ No newline at end of file
+void fpu_init_cpu();
+void fpu_init_thread(thread_t* thread);
+void fpu_switch(thread_t* prev, const thread_t* next);
+void fpu_release(thread_t* thread);
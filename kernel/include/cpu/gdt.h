@@ -1,8 +1,13 @@
 #pragma once
 
+#include "kernel/cpu/tss.h"
 #include "libc/stdint.h"
 
-#define NO_GDT_DESCRIPTORS 6
+#define NO_GDT_DESCRIPTORS 8
+
+// User data segment whose base is the current thread's, see `gdt_set_tls`
+#define GDT_TLS_ENTRY 7
+#define GDT_TLS_SELECTOR 0x3B
 
 // GDT access flags.
 #define GDT_READWRITE (1 << 1) // Read/write access.
@@ -49,15 +54,32 @@ extern void load_gdt(uint32_t gdt_ptr);
 
 /**
  * Sets the properties of a GDT entry.
+ * @param gdt - The GDT to modify.
  * @param index - Index of the GDT entry.
  * @param base - Base address of the segment.
  * @param limit - Size (limit) of the segment.
  * @param access - Access flags.
  * @param gran - Granularity flags.
  */
-void gdt_set_entry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
+void gdt_set_entry(GDT* gdt, int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
+
+/**
+ * Points the TLS segment of `gdt` to `base`. User code reaches it through %gs.
+ * @param base - Base address of the segment, anywhere in userspace.
+ */
+void gdt_set_tls(GDT* gdt, uintptr_t base);
+
+// Writes a TSS entry into `gdt`, defined in tss.c.
+void write_tss(GDT* gdt, tss_entry_t* tss, int num, uint16_t ss0, uint32_t esp0);
+
+/**
+ * Sets all entries of a CPU's GDT and loads it into the CPU, along with its TSS.
+ * @param percpu - Base of the per-CPU data segment.
+ * @param percpu_size - Size of the per-CPU data segment.
+ */
+void gdt_init_cpu(GDT* gdt, GDT_PTR* gdt_ptr, tss_entry_t* tss, uintptr_t percpu, uint32_t percpu_size);
 
 /**
- * Initializes the GDT by setting all entries and loading it into the CPU.
+ * Initializes the GDT of the boot processor.
  */
 void init_gdt();
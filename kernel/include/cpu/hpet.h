@@ -0,0 +1,27 @@
+#pragma once
+
+#include "kernel/boot/acpi.h"
+#include "libc/stdint.h"
+
+// Register offsets
+#define HPET_CAP 0x00
+#define HPET_CONF 0x10
+#define HPET_COUNTER 0xF0
+
+#define HPET_CAP_COUNT_64 (1 << 13)
+#define HPET_CONF_ENABLE 1
+
+/* The ACPI description of the HPET */
+typedef struct acpi_hpet_t {
+    acpi_sdt_header_t header;
+    uint32_t block_id;
+    acpi_gas_t address;
+    uint8_t number;
+    uint16_t min_tick;
+    uint8_t page_protection;
+} acpi_hpet_t __attribute__((packed));
+
+void init_hpet();
+bool hpet_available();
+uint64_t hpet_read();
+uint64_t hpet_frequency();
@@ -37,3 +37,4 @@ extern void load_idt(uint32_t idt_ptr);
 void idt_set_entry(int index, uint32_t base, uint16_t seg_sel, uint8_t flags);
 
 void init_idt();
+void idt_load();
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Registers, accessed through the select and window registers
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10 // Two registers per entry
+
+// Redirection entry fields
+#define IOAPIC_ACTIVE_LOW (1 << 13)
+#define IOAPIC_LEVEL (1 << 15)
+#define IOAPIC_MASKED (1 << 16)
+
+#define IOAPIC_MAX 8
+#define IOAPIC_ISA_IRQS 16
+
+void init_ioapic();
+bool ioapic_available();
+uint32_t ioapic_vector(uint32_t irq);
+int32_t ioapic_vector_irq(uint32_t vector);
+void ioapic_set_masked(uint32_t irq, bool masked);
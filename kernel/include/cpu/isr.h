@@ -5,7 +5,7 @@
 #define NO_INTERRUPT_HANDLERS 256
 
 typedef struct {
-    uint32_t ds;                                     // Data segment selector.
+    uint32_t gs, fs, es, ds;                         // Segment selectors.
     uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax; // Registers saved by 'pusha'.
     uint32_t int_no, err_code;                       // Interrupt number and error code.
     uint32_t eip, cs, eflags, useresp, ss;           // Pushed automatically by the processor.
@@ -82,6 +82,24 @@ extern void irq_13();
 extern void irq_14();
 extern void irq_15();
 extern void irq_16();
+extern void irq_67();
+extern void irq_68();
+extern void irq_69();
+extern void irq_70();
+extern void irq_71();
+extern void irq_95();
+extern void irq_110();
+extern void irq_125();
+extern void irq_140();
+extern void irq_155();
+extern void irq_170();
+extern void irq_185();
+extern void irq_200();
+extern void irq_209();
+extern void irq_224();
+extern void irq_240();
+extern void irq_241();
+extern void irq_255();
 
 // IRQ default constants
 #define IRQ_BASE 0x20
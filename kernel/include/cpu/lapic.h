@@ -0,0 +1,46 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Register offsets
+#define LAPIC_ID 0x20
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE (1 << 8)
+#define LAPIC_LVT_MASKED (1 << 16)
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+// Interrupt command register fields
+#define LAPIC_ICR_FIXED 0x000
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_PENDING (1 << 12)
+#define LAPIC_ICR_ASSERT (1 << 14)
+
+/* Vectors from here on come from the local APIC itself, and are acknowledged
+ * to it rather than to the PIC.
+ */
+#define LAPIC_VECTOR_BASE 0xF0
+#define LAPIC_TIMER_VECTOR (LAPIC_VECTOR_BASE + 1)
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+void init_lapic(uintptr_t phys);
+bool lapic_available();
+void lapic_enable();
+uint32_t lapic_id();
+void lapic_eoi();
+uint32_t lapic_get_tpr();
+void lapic_set_tpr(uint32_t priority);
+void lapic_send_ipi(uint32_t apic_id, uint32_t command);
+uint32_t lapic_timer_calibrate();
+void lapic_timer_start(uint32_t counts, bool periodic);
+void lapic_timer_stop();
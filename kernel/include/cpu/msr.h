@@ -0,0 +1,11 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Model specific registers
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+uint64_t rdmsr(uint32_t msr);
+void wrmsr(uint32_t msr, uint64_t value);
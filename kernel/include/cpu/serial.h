@@ -9,4 +9,7 @@ void init_serial();
 char read_serial();
 
 // Write a single byte to the serial port
-void write_serial(char a);
\ No newline at end of file
+void write_serial(char a);
+
+// Call the given handler from the interrupt handler for each byte received
+void serial_set_rx_handler(void (*handler)(char));
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "kernel/cpu/cpu.h"
+#include "kernel/cpu/lapic.h"
+#include "libc/stdint.h"
+
+// Physical page the application processors start executing at
+#define SMP_TRAMPOLINE 0x8000
+#define SMP_AP_STACK_SIZE 0x4000
+
+// Asks a CPU to run its scheduler, see `proc_kick`
+#define SMP_IPI_RESCHEDULE LAPIC_VECTOR_BASE
+
+void init_smp();
+void smp_start_aps();
+void smp_send_reschedule(cpu_t* cpu);
+void ap_main(cpu_t* cpu);
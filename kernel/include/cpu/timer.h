@@ -1,18 +1,40 @@
 #pragma once
 
 #include "kernel/cpu/isr.h"
+#include "kernel/sys/wheel.h"
+#include "libc/time.h"
 
 void init_timer();
+void timer_init_cpu();
 void timer_callback(REGISTERS* regs);
 uint32_t timer_get_tick();
-double timer_get_time();
 void timer_register_callback(ISR handler);
+void timer_set_deadline(uint32_t ticks);
+void timer_update();
+void timer_add(wheel_timer_t* timer);
+bool timer_mod(wheel_timer_t* timer, uint32_t expires);
+bool timer_del(wheel_timer_t* timer);
+uint32_t timer_ns_to_ticks(uint64_t ns);
 
-#define TIMER_FREQ 10 // in Hz
+#define TIMER_FREQ 1000 // in Hz
 #define TIMER_QUOTIENT 1193180
+#define TIMER_NS_PER_TICK (1000000000 / TIMER_FREQ)
+
+// PIT counts per tick, and the longest one-shot event the 16-bit counter allows
+#define TIMER_COUNTS_PER_TICK (TIMER_QUOTIENT / TIMER_FREQ)
+#define TIMER_ONESHOT_MAX_TICKS (0xFFFF / TIMER_COUNTS_PER_TICK)
+
+// Timer callbacks run per softirq round, see `softirq.c`
+#define TIMER_SOFTIRQ_BUDGET 64
+
+// Converts a duration to timer ticks, rounding up
+#define TIMER_MS_TO_TICKS(ms) (((ms) * TIMER_FREQ + 999) / 1000)
 
 #define PIT_0 0x40
 #define PIT_1 0x41
 #define PIT_2 0x42
 #define PIT_CMD 0x43
-#define PIT_SET 0x36
+#define PIT_SET 0x36      // Channel 0, lobyte/hibyte, rate generator
+#define PIT_ONESHOT 0x30  // Channel 0, lobyte/hibyte, interrupt on terminal count
+#define PIT_READBACK 0xC2 // Latch the status and count of channel 0
+#define PIT_STATUS_OUT 0x80
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Calibration takes this long, the longer the more precise
+#define TSC_CALIBRATION_MS 10
+
+#define PIT_GATE 0x61
+#define PIT_GATE_SPEAKER 0x02
+#define PIT_GATE_ENABLE 0x01
+#define PIT_GATE_OUT 0x20
+
+void init_tsc();
+uint64_t tsc_read();
+uint64_t tsc_frequency();
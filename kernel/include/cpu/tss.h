@@ -27,5 +27,4 @@ typedef struct {
 } __attribute__((packed)) tss_entry_t;
 
 extern void load_tss();                                      // Load the TSS.
-extern void write_tss(int num, uint16_t ss0, uint32_t esp0); // Write TSS entry.
 extern void set_kernel_stack(uint32_t stack);                // Set the kernel stack pointer.
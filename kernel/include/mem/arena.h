@@ -0,0 +1,33 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+#define ARENA_ALIGN 4
+
+/* Arenas hand out memory from page-backed chunks. When the current chunk is
+ * exhausted a new one is chained in front of it, so older chunks can be
+ * released in one go when resetting to a mark.
+ */
+typedef struct _arena_chunk_t {
+    struct _arena_chunk_t* prev;
+    uint32_t size; // Usable bytes, header excluded
+    uint32_t used;
+} arena_chunk_t;
+
+typedef struct _arena_t {
+    arena_chunk_t* chunk; // The chunk allocations are bumped from
+    arena_chunk_t* first; // Embeds this structure, freed last
+} arena_t;
+
+/* A position in an arena, as returned by `arena_mark` */
+typedef struct {
+    arena_chunk_t* chunk;
+    uint32_t used;
+} arena_mark_t;
+
+arena_t* arena_create(uint32_t num_pages);
+void* arena_alloc(arena_t* arena, uint32_t size);
+char* arena_strdup(arena_t* arena, const char* str);
+arena_mark_t arena_mark(arena_t* arena);
+void arena_reset(arena_t* arena, arena_mark_t mark);
+void arena_destroy(arena_t* arena);
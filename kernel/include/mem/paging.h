@@ -24,6 +24,7 @@ void paging_fault_handler(REGISTERS* regs);
 void* paging_alloc_pages(uint32_t virt, uint32_t num);
 void paging_free_pages(uintptr_t virt, uint32_t num);
 uintptr_t paging_virt_to_phys(uintptr_t virt);
+void* paging_map_mmio(uintptr_t phys, uint32_t size, uint32_t flags);
 
 #define KERNEL_BASE_VIRT 0xC0000000
 
@@ -41,13 +42,25 @@ uintptr_t paging_virt_to_phys(uintptr_t virt);
 #define KERNEL_HEAP_BEGIN KERNEL_END_MAP
 #define KERNEL_HEAP_SIZE 0x1E00000
 
+/* Device memory and firmware tables are mapped right after the heap, see
+ * `paging_map_mmio`.
+ */
+#define KERNEL_MMIO_BEGIN (KERNEL_HEAP_BEGIN + KERNEL_HEAP_SIZE)
+#define KERNEL_MMIO_SIZE 0x400000
+
 #define PHYS_TO_VIRT(addr) ((addr) + KERNEL_BASE_VIRT)
 #define VIRT_TO_PHYS(addr) ((addr) - KERNEL_BASE_VIRT)
 
 #define PAGE_PRESENT 1
 #define PAGE_RW 2
 #define PAGE_USER 4
+#define PAGE_NOCACHE 16
 #define PAGE_LARGE 128
+// Available to software: the frame isn't owned by the address space, see `elf.c`
+#define PAGE_SHARED 512
+// Available to software in non-present entries: the page may never be mapped,
+// see `proc_guard`
+#define PAGE_GUARD 1024
 
 #define PAGE_FRAME 0xFFFFF000
 #define PAGE_FLAGS 0x00000FFF
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "kernel/sys/proc.h"
+#include "libc/stdint.h"
+
+#define ELF_MAGIC 0x464C457F // "\x7FELF", read as a little endian word
+#define ELF_CLASS_32 1
+#define ELF_DATA_LSB 1
+#define ELF_TYPE_EXEC 2
+#define ELF_MACHINE_386 3
+
+#define ELF_PT_LOAD 1
+
+#define ELF_PF_X 1
+#define ELF_PF_W 2
+#define ELF_PF_R 4
+
+typedef struct {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t version;
+    uint8_t abi;
+    uint8_t pad[8];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t elf_version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} elf_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} elf_phdr_t;
+
+/* What `elf_load` mapped, for the process to be set up from */
+typedef struct {
+    uintptr_t entry;
+    uint32_t num_pages; // Private pages mapped at load time
+    proc_region_t zero_regions[PROC_ZERO_REGIONS];
+    uint32_t num_zero_regions;
+} elf_image_t;
+
+bool elf_check(uint8_t* data, uint32_t size);
+void elf_load(uint8_t* data, uintptr_t directory, elf_image_t* image);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Number of wait queues, as a power of two
+#define FUTEX_HASH_BITS 6
+#define FUTEX_BUCKETS (1 << FUTEX_HASH_BITS)
+
+int32_t futex_do_wait(uintptr_t addr, uint32_t val, bool timed, uint64_t ns);
+int32_t futex_do_wake(uintptr_t addr, uint32_t num);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Shortest delay the timer interrupt is programmed for, so that due timers
+// whose softirq was put off don't keep interrupting us in the meantime
+#define HRTIMER_MIN_DELTA_NS 10000
+
+/* A one-shot timer expiring at a given time of the monotonic clock, in
+ * nanoseconds, rather than on a tick like those of the wheel.
+ */
+typedef struct _hrtimer_t {
+    // Links of the pairing heap, see `hrtimer.c`
+    struct _hrtimer_t* child;
+    struct _hrtimer_t* next;
+    struct _hrtimer_t* prev;
+    uint64_t expires;
+    void (*callback)(struct _hrtimer_t*);
+    void* data;
+    bool pending;
+} hrtimer_t;
+
+void hrtimer_add(hrtimer_t* timer);
+bool hrtimer_mod(hrtimer_t* timer, uint64_t expires);
+bool hrtimer_del(hrtimer_t* timer);
+bool hrtimer_del_sync(hrtimer_t* timer);
+bool hrtimer_pending(hrtimer_t* timer);
+bool hrtimer_run(uint64_t now, uint32_t budget);
+bool hrtimer_next_expiry(uint64_t* expires);
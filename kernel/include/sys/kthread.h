@@ -0,0 +1,5 @@
+#pragma once
+
+#include "kernel/sys/proc.h"
+
+thread_t* kthread_create(void (*func)(void*), void* arg);
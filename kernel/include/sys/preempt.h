@@ -0,0 +1,9 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+void preempt_disable();
+void preempt_enable();
+uint32_t preempt_count();
+void preempt_set_need_resched();
+void preempt_check_resched();
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "kernel/cpu/cpu.h"
 #include "kernel/kernel.h"
 #include "kernel/lib/kprintf.h"
+#include "kernel/mem/paging.h"
+#include "kernel/sys/hrtimer.h"
+#include "kernel/sys/spinlock.h"
+#include "kernel/sys/workqueue.h"
 #include "kernel/utils/debug.h"
 #include "kernel/utils/linkedlist.h"
+#include "libc/resource.h"
 #include "libc/stdint.h"
 #include "libc/string.h"
 
@@ -11,48 +17,192 @@
 #define PROC_KERNEL_STACK_PAGES 1
 #define PROC_MAX_FD 1024
 
-// Add new members to the end to avoid messing with the offsets
+#define PROC_STATE_RUNNING 0
+#define PROC_STATE_BLOCKED 1
+#define PROC_STATE_EXITED 2 // Waiting for `proc_reap`
+#define PROC_STATE_DEAD 3   // Reaped, only kept for `proc_thread_join`
+
+#define PROC_NICE_MIN -20
+#define PROC_NICE_MAX 19
+
+// The thread executing on this CPU, and the process it belongs to
+#define current_thread (cpu_current()->current)
+#define current_process (current_thread->process)
+
+#define PROC_ZERO_REGIONS 4
+
+/* Pages of user memory mapped on first access, already zeroed, with the given
+ * page flags. Used for .bss, see `proc_fault`.
+ */
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    uint32_t flags;
+} proc_region_t;
+
+/* Resource usage of a thread, or of several of them summed up. Kept by the CPU
+ * running the thread, see `proc_getrusage`.
+ */
+typedef struct {
+    uint64_t run_ns;
+    // Timer interrupts that found the thread in userspace, or in the kernel
+    uint32_t user_ticks;
+    uint32_t system_ticks;
+    uint32_t voluntary_switches;   // Blocked or exited
+    uint32_t involuntary_switches; // Preempted or yielded
+    uint32_t faults;               // Pages mapped on demand, see `proc_fault`
+} proc_usage_t;
+
+/* A schedulable context. Threads of a process share its address space and
+ * resources, everything else is theirs. Add new members to the end to avoid
+ * messing with the offsets, which `proc.asm` relies on.
+ */
+typedef struct _thread_t {
+    uint32_t tid; // Unique within the process
+    struct _proc_t* process;
+    // Same as the process's, at hand for `proc.asm`
+    uintptr_t directory;
+    // Kernel stack used when the thread is preempted
+    uintptr_t kernel_stack;
+    // Kernel stack to restore when the thread is switched to
+    uintptr_t saved_kernel_stack;
+    // FPU save area, 64 bytes aligned, sized by `fpu.c`
+    void* fpu_state;
+    int32_t nice;
+    // Private to the scheduler the thread was added to
+    void* sched_data;
+    uint32_t state;
+    // Wakes the thread up at the end of `proc_sleep`
+    hrtimer_t sleep_timer;
+    // Entry point of kernel threads, see `kthread_create`
+    void (*kthread_func)(void*);
+    void* kthread_arg;
+    // Frees the thread once it has exited
+    work_t reap_work;
+    // CPU whose run queue the thread belongs to
+    struct cpu_t* cpu;
+    // Set from the moment a CPU elects the thread until that CPU is done
+    // switching away from it, see `proc_switch_finish`
+    volatile bool on_cpu;
+    // CPU whose FPU last held the thread's state, see `fpu.c`
+    struct cpu_t* fpu_cpu;
+    // Next thread of the process, protected by the process's lock
+    struct _thread_t* next;
+    uint32_t exit_status;
+    // Thread waiting in `proc_thread_join` for this one to be reaped
+    struct _thread_t* joiner;
+    // Base of the TLS segment, see `proc_set_tls`
+    uintptr_t tls_base;
+    // Set by the timer interrupt for the ring to be polled, see `proc_user_work`
+    bool ring_poll_due;
+    proc_usage_t usage;
+    // When the thread was last switched to, see `proc_switch_to`
+    uint64_t run_start;
+    // Per system call number, allocated on the first call
+    struct syscall_proc_stat_t* syscall_stats;
+} thread_t;
+
+/* An address space and the resources shared by its threads. The kernel's own
+ * threads all belong to the kernel process, see `kthread_create`.
+ */
 typedef struct _proc_t {
     uint32_t pid;
     // Sizes of the exectuable and of the stack in number of pages
     uint32_t stack_len;
     uint32_t code_len;
     uintptr_t directory;
-    // Kernel stack used when the process is preempted
-    uintptr_t kernel_stack;
-    // Kernel stack to restore when the process is switched to
-    uintptr_t saved_kernel_stack;
-    // Stack to use when first switching to userspace for a new process
-    uintptr_t initial_user_stack;
-    uint32_t mem_len; // Size of program heap in bytes
-    uint32_t sleep_ticks;
-    uint8_t fpu_registers[512];
+    // System call ring, see `ring.c`
+    struct _ring_t* ring;
+    // Per system call number, those of the threads already joined
+    struct syscall_proc_stat_t* syscall_stats;
+    // Demand-zero regions of the executable, see `elf_load`
+    proc_region_t zero_regions[PROC_ZERO_REGIONS];
+    uint32_t num_zero_regions;
+    // Protects the thread list and changes to the user part of the address
+    // space, which all threads see
+    spinlock_t lock;
+    thread_t* threads;
+    // Threads not reaped yet, the process goes away with the last one
+    uint32_t num_threads;
+    uint32_t next_tid;
+    // Pages of user memory mapped for the process, none are ever unmapped
+    uint32_t resident_pages;
+    // Usage of the threads already joined
+    proc_usage_t joined_usage;
+    // Next in the list of processes, see `proc_print_processes`
+    struct _proc_t* next;
+    // Set by `proc_exit_process`, threads then exit with `exit_status`
+    bool exiting;
+    uint32_t exit_status;
 } process_t;
 
 /* This structure defines the interface of schedulers in SnowflakeOS.
  */
 typedef struct _sched_t {
-    /* Returns the currently elected process */
-    process_t* (*sched_get_current)(struct _sched_t*);
-    /* Adds a new process, already initialized, to the process pool */
-    void (*sched_add)(struct _sched_t*, process_t*);
-    /* Returns the next process that should be run, depending to the specific
-       scheduler implemented. Note that it can choose not to change process by
-       returning the currently executing process */
-    process_t* (*sched_next)(struct _sched_t*);
-    /* Removes a process from the process pool. Basically the inverse of
-     * `sched_add`. If the removed process was the one currently executing, the
+    /* Returns the currently elected thread */
+    thread_t* (*sched_get_current)(struct _sched_t*);
+    /* Adds a new thread, already initialized, to the thread pool */
+    void (*sched_add)(struct _sched_t*, thread_t*);
+    /* Returns the next thread that should be run, depending to the specific
+       scheduler implemented. Note that it can choose not to change thread by
+       returning the currently executing thread, and returns NULL when no
+       thread is runnable */
+    thread_t* (*sched_next)(struct _sched_t*);
+    /* Removes a thread from the thread pool. Basically the inverse of
+     * `sched_add`. If the removed thread was the one currently executing, the
      * scheduler must ensure that `sched_next` keeps working: it'll be called
      * right after.
      */
-    void (*sched_exit)(struct _sched_t*, process_t*);
+    void (*sched_exit)(struct _sched_t*, thread_t*);
+    /* Charges `ticks` clock ticks to the executing thread. Returns whether
+     * it should be preempted, in which case `sched_next` is called right after.
+     */
+    bool (*sched_tick)(struct _sched_t*, thread_t*, uint32_t ticks);
+    /* Returns in how many ticks the executing thread should be preempted,
+     * or 0 if it can run for as long as it wants. The timer only interrupts
+     * the thread then, see `timer_set_deadline`.
+     */
+    uint32_t (*sched_ticks_left)(struct _sched_t*, thread_t*);
+    /* Takes the executing thread out of the pool of runnable threads, until
+     * it's passed to `sched_unblock`. As with `sched_exit`, `sched_next` is
+     * called right after, and may return NULL if nothing is left to run.
+     */
+    void (*sched_block)(struct _sched_t*, thread_t*);
+    /* Makes a thread previously passed to `sched_block` runnable again */
+    void (*sched_unblock)(struct _sched_t*, thread_t*);
+    /* Removes a runnable thread from the pool for another CPU to run it, or
+     * returns NULL if there's none. Neither the executing thread nor any
+     * thread whose `on_cpu` is set may be picked.
+     */
+    thread_t* (*sched_steal)(struct _sched_t*);
 } sched_t;
 
 void init_proc();
 process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv);
 void proc_print_processes();
 void proc_schedule();
-void proc_exit();
+void proc_exit(uint32_t status);
+void proc_exit_process(uint32_t status);
+void proc_yield();
+void proc_add(thread_t* thread);
+void proc_block();
+void proc_block_on(spinlock_t* lock);
+void proc_unblock(thread_t* thread);
+void proc_sleep(uint64_t ns);
+int32_t proc_nice(int32_t increment);
 void proc_enter_usermode();
-void proc_switch_process(process_t* next);
+thread_t* proc_create_kernel_task(void (*entry)());
+int32_t proc_thread_create(uintptr_t entry, uintptr_t stack, uint32_t arg);
+int32_t proc_thread_join(uint32_t tid, uint32_t* status);
+int32_t proc_set_tls(uintptr_t base);
+int32_t proc_guard(uintptr_t addr, uint32_t num);
+int32_t proc_getrusage(uint32_t who, rusage_t* usage);
+uint64_t proc_idle_ns();
+void* proc_map_temp(uint32_t slot, uintptr_t phys);
+page_t* proc_get_page(uintptr_t directory, uintptr_t virt, bool create, uint32_t flags);
+void proc_switch_process(thread_t* next);
+void proc_switch_finish(thread_t* prev);
+void proc_user_work();
+bool proc_fault(uintptr_t addr);
+bool proc_check_user(uintptr_t addr, uint32_t size, bool write);
 uint32_t proc_get_current_pid();
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+struct _proc_t;
+struct _thread_t;
+
+/* Where the ring of a process is mapped, see `ring_setup` */
+#define RING_USER_ADDR 0xBF000000
+#define RING_MAX_ENTRIES 256
+
+/* With this setup flag, the kernel drains the submission queue on its own on
+ * each timer tick the process takes, no `ring_enter` needed.
+ */
+#define RING_SETUP_POLL 1
+#define RING_POLL_TICKS 1
+
+/* A system call to run, whose arguments are passed as %ebx, %ecx and %edx */
+typedef struct {
+    uint32_t opcode; // System call number
+    uint32_t user_data; // Copied as is to the completion
+    uint32_t args[3];
+    uint32_t reserved[3];
+} ring_sqe_t;
+
+/* The outcome of a submission, `result` being %eax after the system call */
+typedef struct {
+    uint32_t user_data;
+    int32_t result;
+} ring_cqe_t;
+
+/* Shared with userspace at the start of the ring. Userspace fills entries of
+ * the submission queue then advances `sq_tail`, and consumes completions up
+ * to `cq_tail` then advances `cq_head`. Indices are free running, entries are
+ * found at `index & (size - 1)`.
+ */
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t sq_entries; // A power of two
+    uint32_t cq_entries; // Twice as many, for submissions to keep flowing
+    uint32_t sq_offset; // Of the submission queue, from the start of the ring
+    uint32_t cq_offset;
+    uint32_t flags;
+} ring_header_t;
+
+/* The kernel's own copy of the ring state, which userspace can't tamper with */
+typedef struct _ring_t {
+    ring_header_t* header;
+    ring_sqe_t* sqes;
+    ring_cqe_t* cqes;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_head;
+    uint32_t cq_tail;
+    uint32_t flags;
+    // Thread running the submissions, see `ring_enter`
+    struct _thread_t* volatile owner;
+} ring_t;
+
+uintptr_t ring_setup(uint32_t entries, uint32_t flags);
+uint32_t ring_enter(uint32_t to_submit);
+void ring_poll(struct _proc_t* process);
+bool ring_polled(struct _proc_t* process);
+void ring_thread_exit(struct _thread_t* thread);
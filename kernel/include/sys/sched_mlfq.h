@@ -0,0 +1,8 @@
+#pragma once
+
+#include "kernel/sys/proc.h"
+
+#define MLFQ_LEVELS 8
+#define MLFQ_BOOST_MS 1000
+
+sched_t* sched_mlfq();
@@ -2,4 +2,6 @@
 
 #include "kernel/sys/proc.h"
 
+#define ROBIN_QUANTUM_MS 100
+
 sched_t* sched_robin();
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "kernel/sys/workqueue.h"
+#include "libc/stdint.h"
+
+/* Sources of deferred interrupt work, run in this order */
+#define SOFTIRQ_TIMER 0 // Expired timers of the wheel
+#define SOFTIRQ_SCHED 1 // Scheduler tick of the current thread
+#define SOFTIRQ_COUNT 2
+
+// Times pending softirqs are rerun on interrupt exit before the rest of the
+// work is left to the softirq thread
+#define SOFTIRQ_MAX_ROUNDS 4
+
+/* Does up to `budget` units of work of a source, returns whether some is left */
+typedef bool (*softirq_handler_t)(uint32_t budget);
+
+typedef struct {
+    softirq_handler_t handler;
+    uint32_t budget;
+    // Runs the work left over from interrupt exit, see `softirq_run`
+    work_t work;
+} softirq_t;
+
+void init_softirq();
+void softirq_register(uint32_t nr, softirq_handler_t handler, uint32_t budget);
+void softirq_raise(uint32_t nr);
+void softirq_run();
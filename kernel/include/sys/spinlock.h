@@ -0,0 +1,24 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+#define EFLAGS_IF (1 << 9)
+
+/* A test-and-test-and-set lock. Waiters spin on a plain read, so that the
+ * cache line isn't bounced around until the lock looks free.
+ */
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {.locked = 0}
+
+uint32_t irq_save();
+void irq_restore(uint32_t flags);
+bool irq_enabled();
+
+void spin_lock(spinlock_t* lock);
+bool spin_trylock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+uint32_t spin_lock_irqsave(spinlock_t* lock);
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags);
@@ -8,3 +8,5 @@
 typedef void (*sys_handler_t)(REGISTERS*);
 
 void init_syscall();
+void syscall_init_cpu();
+void syscall_handler(REGISTERS* regs);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Bucket `n` counts calls that took [4^n, 4^(n+1)) cycles, the last one more
+#define SYSCALL_STATS_BUCKETS 16
+
+// Receiving ^T on the serial line dumps the statistics there
+#define SYSCALL_STATS_DUMP_KEY 0x14
+
+// Scopes of the `syscall_stats` system call
+#define SYSCALL_STATS_SYSTEM 0
+#define SYSCALL_STATS_PROCESS 1
+
+/* Statistics of a system call number, as returned by `syscall_stats`. Cycles
+ * are TSC cycles from dispatch to return, blocking included.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+    uint32_t histogram[SYSCALL_STATS_BUCKETS];
+} syscall_stat_t;
+
+/* What's kept per process, for every system call number */
+typedef struct syscall_proc_stat_t {
+    uint64_t count;
+    uint64_t cycles;
+} syscall_proc_stat_t;
+
+struct _thread_t;
+
+void init_syscall_stats();
+uint64_t syscall_stats_begin(uint32_t num);
+void syscall_stats_end(uint32_t num, uint64_t start);
+void syscall_stats_unknown();
+bool syscall_stats_get(uint32_t num, uint32_t scope, syscall_stat_t* stat);
+syscall_proc_stat_t* syscall_stats_join(struct _thread_t* thread);
+void syscall_stats_dump();
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+/* The root level of the wheel has one slot per tick, each of the upper levels
+ * covers `WHEEL_LEVEL_BITS` more bits of the expiry tick, 32 bits in total.
+ */
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVELS 4
+
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+
+typedef struct _wheel_timer_t {
+    struct _wheel_timer_t* next;
+    // Points to the previous node's `next` or to the slot, NULL when idle
+    struct _wheel_timer_t** pprev;
+    uint32_t expires; // Absolute, in timer ticks
+    void (*callback)(struct _wheel_timer_t*);
+    void* data;
+} wheel_timer_t;
+
+void wheel_add(wheel_timer_t* timer);
+bool wheel_mod(wheel_timer_t* timer, uint32_t expires);
+bool wheel_del(wheel_timer_t* timer);
+bool wheel_pending(wheel_timer_t* timer);
+bool wheel_run(uint32_t now, uint32_t budget);
+bool wheel_next_expiry(uint32_t* expires);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "kernel/sys/spinlock.h"
+#include "libc/stdint.h"
+
+struct _thread_t;
+
+/* A unit of deferred work, usually embedded in the structure it's about */
+typedef struct _work_t {
+    struct _work_t* next;
+    void (*func)(struct _work_t*);
+    void* data;
+    bool pending; // Queued but not yet started
+} work_t;
+
+/* Work is run in order, one item at a time, by a dedicated kernel thread */
+typedef struct {
+    work_t* head;
+    work_t* tail;
+    spinlock_t lock; // Protects the queue, taken with interrupts disabled
+    struct _thread_t* worker;
+} workqueue_t;
+
+extern workqueue_t* system_wq;
+
+void init_workqueue();
+workqueue_t* workqueue_create();
+void init_work(work_t* work, void (*func)(work_t*), void* data);
+bool queue_work(workqueue_t* wq, work_t* work);
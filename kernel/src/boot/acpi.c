@@ -0,0 +1,105 @@
+#include "kernel/boot/acpi.h"
+
+#include "kernel/boot/multiboot2.h"
+#include "kernel/mem/paging.h"
+#include "kernel/utils/debug.h"
+#include "libc/string.h"
+
+/* Tables listed by the RSDT, mapped once and for all at boot */
+static acpi_sdt_header_t* tables[ACPI_MAX_TABLES];
+static uint32_t table_count;
+
+static bool acpi_checksum_ok(void* data, uint32_t length) {
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        sum += ((uint8_t*) data)[i];
+    }
+
+    return sum == 0;
+}
+
+/* Maps the whole table at physical address `phys`.
+ */
+static acpi_sdt_header_t* acpi_map_table(uintptr_t phys) {
+    acpi_sdt_header_t* header = paging_map_mmio(phys, sizeof(acpi_sdt_header_t), 0);
+
+    // Mapped a second time now that we know its length, the window is large
+    // enough for this to not matter
+    return paging_map_mmio(phys, header->length, 0);
+}
+
+/* Maps the ACPI tables listed by the RSDP GRUB passed us. The RSDT is used
+ * even on ACPI 2.0 machines: the 64-bit addresses of the XSDT are of no use to
+ * us. Must be called after paging is set up, and before any process is
+ * created, as processes don't see mappings created later on.
+ */
+void init_acpi(mb2_t* boot) {
+    mb2_tag_rsdp1_t* tag = (mb2_tag_rsdp1_t*) mb2_find_tag(boot, MB2_TAG_RSDP2);
+
+    if (!tag) {
+        tag = (mb2_tag_rsdp1_t*) mb2_find_tag(boot, MB2_TAG_RSDP1);
+    }
+
+    if (!tag || !acpi_checksum_ok(&tag->rsdp, sizeof(acpi_rsdp1_t))) {
+        kprintf_info("no ACPI tables found");
+        return;
+    }
+
+    acpi_sdt_header_t* rsdt = acpi_map_table(tag->rsdp.rsdt_addr);
+
+    if (strncmp(rsdt->signature, "RSDT", 4) || !acpi_checksum_ok(rsdt, rsdt->length)) {
+        kprintf_error("invalid RSDT");
+        return;
+    }
+
+    uint32_t* entries = (uint32_t*) (rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(acpi_sdt_header_t)) / sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < count && table_count < ACPI_MAX_TABLES; i++) {
+        acpi_sdt_header_t* table = acpi_map_table(entries[i]);
+
+        if (acpi_checksum_ok(table, table->length)) {
+            tables[table_count++] = table;
+        }
+    }
+
+    kprintf_info("found %d ACPI tables", table_count);
+}
+
+/* Returns the table with the given four letters signature, NULL if absent.
+ */
+acpi_sdt_header_t* acpi_find_table(const char* signature) {
+    for (uint32_t i = 0; i < table_count; i++) {
+        if (!strncmp(tables[i]->signature, signature, 4)) {
+            return tables[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns the first entry of the given type following `prev` in the MADT, or
+ * the first one at all if `prev` is NULL. Returns NULL past the last one.
+ */
+acpi_madt_entry_t* acpi_madt_next(acpi_madt_t* madt, acpi_madt_entry_t* prev, uint8_t type) {
+    uintptr_t end = (uintptr_t) madt + madt->header.length;
+    uintptr_t addr = prev ? (uintptr_t) prev + prev->length : (uintptr_t) (madt + 1);
+
+    while (addr + sizeof(acpi_madt_entry_t) <= end) {
+        acpi_madt_entry_t* entry = (acpi_madt_entry_t*) addr;
+
+        // A zero length would have us loop forever
+        if (!entry->length) {
+            break;
+        }
+
+        if (entry->type == type) {
+            return entry;
+        }
+
+        addr += entry->length;
+    }
+
+    return NULL;
+}
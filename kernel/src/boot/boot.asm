@@ -86,9 +86,11 @@ _start:
     or ecx, 0x00000010
     mov cr4, ecx
 
-    ; Enable paging by setting the PG bit in CR0
+    ; Enable paging by setting the PG bit in CR0, along with WP so that the
+    ; kernel can't write to read-only pages either: some are shared between
+    ; processes, see `elf.c`
     mov ecx, cr0
-    or ecx, 0x80000000
+    or ecx, 0x80010000
     mov cr0, ecx
 
     ; Jump to the higher-half kernel code
@@ -0,0 +1,52 @@
+#include "kernel/boot/cmdline.h"
+
+#include "libc/string.h"
+
+/* The command line GRUB passed us, split into NUL-terminated words. */
+static char cmdline[CMDLINE_MAX];
+static uint32_t cmdline_len;
+
+/* Copies the kernel command line out of the multiboot structure, which isn't
+ * mapped once processes run.
+ */
+void init_cmdline(mb2_t* boot) {
+    mb2_tag_cmdline_t* tag = (mb2_tag_cmdline_t*) mb2_find_tag(boot, MB2_TAG_CMDLINE);
+
+    if (!tag) {
+        return;
+    }
+
+    cmdline_len = strnlen((char*) tag->cmdline, CMDLINE_MAX - 1);
+    memcpy(cmdline, tag->cmdline, cmdline_len);
+
+    for (uint32_t i = 0; i < cmdline_len; i++) {
+        if (cmdline[i] == ' ') {
+            cmdline[i] = '\0';
+        }
+    }
+}
+
+/* Looks for a `key=value` word on the command line. Returns a pointer to the
+ * value, an empty string if `key` is given without a value, or NULL if it
+ * isn't present.
+ */
+const char* cmdline_get(const char* key) {
+    uint32_t key_len = strlen(key);
+    uint32_t i = 0;
+
+    while (i < cmdline_len) {
+        char* word = &cmdline[i];
+
+        if (!strncmp(word, key, key_len)) {
+            if (word[key_len] == '=') {
+                return &word[key_len + 1];
+            } else if (word[key_len] == '\0') {
+                return &word[key_len];
+            }
+        }
+
+        i += strlen(word) + 1;
+    }
+
+    return NULL;
+}
@@ -2,6 +2,9 @@
 
 #include "kernel/cpu/ports.h"
 
+/* Last value written to the mask registers, reading them back is slow */
+static uint16_t mask;
+
 void pic8259_init() {
     uint8_t a1, a2;
 
@@ -29,6 +32,8 @@ void pic8259_init() {
     // Restore the original mask registers to their previous state
     outportb(PIC1_DATA, a1);
     outportb(PIC2_DATA, a2);
+
+    mask = a1 | a2 << 8;
 }
 
 void pic8259_eoi(uint8_t irq) {
@@ -36,4 +41,25 @@ void pic8259_eoi(uint8_t irq) {
     if (irq >= 0x28)
         outportb(PIC2_COMMAND, PIC_EOI);
     outportb(PIC1_COMMAND, PIC_EOI);
-}
\ No newline at end of file
+}
+
+void pic8259_disable() {
+    pic8259_set_mask(0xFFFF);
+}
+
+uint16_t pic8259_get_mask() {
+    return mask;
+}
+
+void pic8259_set_mask(uint16_t new_mask) {
+    // Each PIC is only written to if its part changed
+    if ((new_mask ^ mask) & 0xFF) {
+        outportb(PIC1_DATA, new_mask & 0xFF);
+    }
+
+    if ((new_mask ^ mask) >> 8) {
+        outportb(PIC2_DATA, new_mask >> 8);
+    }
+
+    mask = new_mask;
+}
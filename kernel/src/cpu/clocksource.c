@@ -0,0 +1,191 @@
+#include "kernel/cpu/clocksource.h"
+
+#include "kernel/boot/cmdline.h"
+#include "kernel/cpu/hpet.h"
+#include "kernel/cpu/tsc.h"
+#include "kernel/sys/spinlock.h"
+#include "kernel/sys/wheel.h"
+#include "kernel/utils/debug.h"
+#include "libc/string.h"
+
+static clocksource_t* current;
+
+// Nanoseconds since boot at `cycle_last` on the current clocksource
+static uint64_t ns_base;
+static uint64_t cycle_last;
+
+// Odd while the above are being updated, so that other CPUs retry their read
+static volatile uint32_t clock_seq;
+
+// Folds elapsed cycles into `ns_base` before the counter wraps around
+static wheel_timer_t refresh_timer;
+static uint32_t refresh_ticks;
+
+static uint64_t jiffies_read() {
+    return timer_get_tick();
+}
+
+/* The timer tick count, always there as a last resort */
+static clocksource_t jiffies = {
+    .name = "jiffies",
+    .read = jiffies_read,
+    .mask = 0xFFFFFFFF,
+    .rating = 1,
+};
+
+/* Computes `a * mul >> shift` without overflowing in the intermediate
+ * product, for `shift` in [1, 32].
+ */
+static uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint32_t lo = a;
+    uint32_t hi = a >> 32;
+    uint64_t ret = ((uint64_t) lo * mul) >> shift;
+
+    if (hi) {
+        ret += ((uint64_t) hi * mul) << (32 - shift);
+    }
+
+    return ret;
+}
+
+uint64_t clocksource_cycles_to_ns(clocksource_t* cs, uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, cs->mult, cs->shift);
+}
+
+/* Returns the nanoseconds elapsed since boot, or rather since the clocksource
+ * framework was initialized.
+ */
+uint64_t clock_monotonic_ns() {
+    clocksource_t* cs;
+    uint64_t base, last;
+    uint32_t seq;
+
+    do {
+        seq = clock_seq;
+        asm volatile("" ::: "memory");
+
+        cs = current;
+        base = ns_base;
+        last = cycle_last;
+
+        asm volatile("" ::: "memory");
+    } while (seq & 1 || seq != clock_seq);
+
+    return base + clocksource_cycles_to_ns(cs, (cs->read() - last) & cs->mask);
+}
+
+/* Returns whether the monotonic clock merely counts timer ticks, for lack of
+ * a better clocksource. The timer can't keep time off it then.
+ */
+bool clock_is_jiffies() {
+    return current == &jiffies;
+}
+
+/* Busy-waits for at least `ns` nanoseconds.
+ */
+void clock_delay_ns(uint64_t ns) {
+    uint64_t end = clock_monotonic_ns() + ns;
+
+    while (clock_monotonic_ns() < end) {
+        asm volatile("pause");
+    }
+}
+
+static void clock_write_begin() {
+    clock_seq++;
+    asm volatile("" ::: "memory");
+}
+
+static void clock_write_end() {
+    asm volatile("" ::: "memory");
+    clock_seq++;
+}
+
+void clock_ns_to_timespec(uint64_t ns, timespec_t* ts) {
+    uint32_t sec = ns / NS_PER_SEC;
+
+    ts->tv_sec = sec;
+    ts->tv_nsec = ns - (uint64_t) sec * NS_PER_SEC;
+}
+
+static void clocksource_refresh(wheel_timer_t* timer) {
+    // Timer callbacks run with interrupts enabled, and a reader interrupting
+    // the update would wait for it forever
+    uint32_t flags = irq_save();
+    uint64_t now = current->read();
+
+    clock_write_begin();
+    ns_base += clocksource_cycles_to_ns(current, (now - cycle_last) & current->mask);
+    cycle_last = now;
+    clock_write_end();
+    irq_restore(flags);
+
+    timer_mod(timer, timer->expires + refresh_ticks);
+}
+
+/* Switches the monotonic clock over to `cs`, without it jumping.
+ */
+static void clocksource_select(clocksource_t* cs) {
+    uint64_t now = current ? clock_monotonic_ns() : 0;
+
+    clock_write_begin();
+    current = cs;
+    ns_base = now;
+    cycle_last = cs->read();
+    clock_write_end();
+
+    timer_del(&refresh_timer);
+
+    // 64-bit counters don't wrap around in our lifetime
+    if (cs->mask == 0xFFFFFFFFFFFFFFFF) {
+        return;
+    }
+
+    uint64_t wrap_ns = clocksource_cycles_to_ns(cs, cs->mask);
+    refresh_ticks = timer_ns_to_ticks(wrap_ns / 2);
+
+    refresh_timer.expires = timer_get_tick() + refresh_ticks;
+    refresh_timer.callback = clocksource_refresh;
+    timer_add(&refresh_timer);
+}
+
+/* Makes `cs`, ticking at `freq` Hz, available to the monotonic clock. It gets
+ * used if it's the best rated one so far. The conversion factor is computed
+ * with as much precision as 32 bits allow.
+ */
+void clocksource_register(clocksource_t* cs, uint64_t freq) {
+    uint32_t shift = 32;
+    uint64_t mult = ((uint64_t) NS_PER_SEC << shift) / freq;
+
+    while (mult > 0xFFFFFFFF && shift > 1) {
+        shift--;
+        mult = ((uint64_t) NS_PER_SEC << shift) / freq;
+    }
+
+    cs->mult = mult;
+    cs->shift = shift;
+
+    kprintf_info("clocksource %s: %d kHz, rating %d", cs->name, (uint32_t) (freq / 1000), cs->rating);
+
+    const char* wanted = cmdline_get("clocksource");
+
+    if (wanted) {
+        if (!strcmp(wanted, cs->name) || !current) {
+            clocksource_select(cs);
+        }
+    } else if (!current || cs->rating > current->rating) {
+        clocksource_select(cs);
+    }
+}
+
+/* Sets up the monotonic clock on the best counter available. `clocksource=`
+ * on the kernel command line overrides the choice. Needs ACPI for the HPET.
+ */
+void init_clocksource() {
+    clocksource_register(&jiffies, TIMER_FREQ);
+
+    init_hpet();
+    init_tsc();
+
+    kprintf_info("using clocksource %s", current->name);
+}
@@ -0,0 +1,26 @@
+#include "kernel/cpu/cpu.h"
+
+cpu_t cpus[CPU_MAX];
+uint32_t cpu_count = 1;
+
+/* Returns the `cpu_t` of the executing processor, read through %fs.
+ */
+cpu_t* cpu_current() {
+    cpu_t* cpu;
+
+    asm volatile("mov %%fs:0, %0" : "=r"(cpu));
+
+    return cpu;
+}
+
+/* Loads the GDT and TSS of `cpu` on the executing processor, and points %fs
+ * to its per-CPU data.
+ */
+void cpu_init(cpu_t* cpu) {
+    cpu->self = cpu;
+    cpu->id = cpu - cpus;
+
+    gdt_init_cpu(cpu->gdt, &cpu->gdt_ptr, &cpu->tss, (uintptr_t) cpu, sizeof(cpu_t));
+
+    asm volatile("mov %0, %%fs" ::"r"((uint16_t) CPU_SELECTOR));
+}
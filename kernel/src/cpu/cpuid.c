@@ -0,0 +1,17 @@
+#include "kernel/cpu/cpuid.h"
+
+cpuid_t cpuid(uint32_t leaf, uint32_t subleaf) {
+    cpuid_t r;
+
+    asm volatile("cpuid\n"
+                 : "=a"(r.eax), "=b"(r.ebx), "=c"(r.ecx), "=d"(r.edx)
+                 : "a"(leaf), "c"(subleaf));
+
+    return r;
+}
+
+/* Returns whether `leaf` is supported, be it a basic or an extended one.
+ */
+bool cpuid_has_leaf(uint32_t leaf) {
+    return cpuid(leaf & 0x80000000, 0).eax >= leaf;
+}
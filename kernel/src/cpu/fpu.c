@@ -1,16 +1,79 @@
 #include "kernel/cpu/fpu.h"
 
+#include "kernel/cpu/cpuid.h"
 #include "kernel/cpu/isr.h"
 #include "kernel/kernel.h"
 #include "kernel/lib/kprintf.h"
+#include "kernel/mem/malloc.h"
+#include "kernel/utils/debug.h"
 
-/* Buffer for FPU context, must be 16-bytes aligned */
-static uint8_t kernel_fpu[512] __attribute__((aligned(16)));
+/* FPU state is switched lazily: switching threads only sets CR0.TS, and the
+ * state is loaded on the first FPU instruction of the new thread, which
+ * raises a device-not-available exception. Threads that never touch the FPU
+ * never pay for it. Each CPU tracks the thread whose state its FPU holds in
+ * `cpu_t.fpu_owner`.
+ *
+ * Saving is eager though: threads may migrate to another CPU, which must
+ * find their latest state in memory. The owner's state is saved when it's
+ * switched out, but stays loaded, so that it doesn't have to be restored if
+ * it's switched back in on the same CPU with no one using the FPU meanwhile.
+ */
+
+/* How state is saved, the best the CPU supports. `xsaveopt` skips components
+ * that are in their initial state or unmodified since the last `xrstor` from
+ * the same buffer.
+ */
+static enum { FPU_FXSAVE, FPU_XSAVE, FPU_XSAVEOPT } fpu_mode = FPU_FXSAVE;
+
+// Components enabled in XCR0, and size of the save area they need
+static uint64_t fpu_features = FPU_XCR0_X87 | FPU_XCR0_SSE;
+static uint32_t fpu_state_size = 512;
 
 void fpu_exception_handler(REGISTERS* regs);
+void fpu_not_available_handler(REGISTERS* regs);
+static void fpu_save(void* state);
 
-// Function to initialize the FPU
-void init_fpu() {
+static void fpu_set_ts() {
+    uint32_t cr0;
+
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" ::"r"(cr0 | CR0_TS));
+}
+
+/* Enables every user state component we know of that the CPU supports, and
+ * picks the save instruction to use.
+ */
+static void fpu_init_xsave() {
+    uint32_t cr4;
+
+    if (!(cpuid(1, 0).ecx & CPUID_ECX_XSAVE)) {
+        return;
+    }
+
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    asm volatile("mov %0, %%cr4" ::"r"(cr4 | CR4_OSXSAVE));
+
+    cpuid_t leaf = cpuid(0xD, 0);
+    uint64_t supported = ((uint64_t) leaf.edx << 32) | leaf.eax;
+
+    fpu_features = supported & FPU_XCR0_USER;
+
+    // AVX-512 components can only be enabled together
+    if ((fpu_features & FPU_XCR0_AVX512) != FPU_XCR0_AVX512) {
+        fpu_features &= ~FPU_XCR0_AVX512;
+    }
+
+    asm volatile("xsetbv\n" ::"c"(0), "a"((uint32_t) fpu_features), "d"((uint32_t) (fpu_features >> 32)));
+
+    // Now reports the size needed for the components enabled in XCR0
+    fpu_state_size = cpuid(0xD, 0).ebx;
+    fpu_mode = cpuid(0xD, 1).eax & CPUID_XSAVE_EAX_XSAVEOPT ? FPU_XSAVEOPT : FPU_XSAVE;
+}
+
+/* Enables the FPU of the executing CPU, with the state components picked by
+ * `init_fpu`. Nobody owns it afterwards.
+ */
+void fpu_init_cpu() {
     uint32_t cr0, cr4;
 
     // Enable the FPU
@@ -22,39 +85,133 @@ void init_fpu() {
     // Enable SSE and FXSAVE/FXRSTOR
     asm volatile("mov %%cr4, %0" : "=r"(cr4));
     cr4 |= (3 << 9); // Set OSFXSR (bit 9) and OSXMMEXCPT (bit 10)
+
+    if (fpu_mode != FPU_FXSAVE) {
+        cr4 |= CR4_OSXSAVE;
+    }
+
     asm volatile("mov %0, %%cr4" ::"r"(cr4));
 
+    if (fpu_mode != FPU_FXSAVE) {
+        asm volatile("xsetbv\n" ::"c"(0), "a"((uint32_t) fpu_features), "d"((uint32_t) (fpu_features >> 32)));
+    }
+
     // Initialize the FPU
     asm volatile("fninit");
 
-    // Register FPU exception handler
+    // Nobody owns the FPU yet
+    fpu_set_ts();
+}
+
+// Function to initialize the FPU
+void init_fpu() {
+    fpu_init_xsave();
+    fpu_init_cpu();
+
+    // Register FPU exception handlers
+    isr_register_handler(7, fpu_not_available_handler);
     isr_register_handler(19, fpu_exception_handler);
+
+    kprintf_info("FPU state: %d bytes, XCR0 0x%x", fpu_state_size, (uint32_t) fpu_features);
+}
+
+/* Gives `thread` a save area in the initial FPU state. With XSAVE, an empty
+ * header marks every component as initial, so the area is mostly zeroes.
+ */
+void fpu_init_thread(thread_t* thread) {
+    uint8_t* state = kamalloc(fpu_state_size, 64);
+
+    memset(state, 0, fpu_state_size);
+    *(uint16_t*) (state + FPU_FCW_OFFSET) = FPU_FCW_DEFAULT;
+    *(uint32_t*) (state + FPU_MXCSR_OFFSET) = FPU_MXCSR_DEFAULT;
+
+    thread->fpu_state = state;
+    thread->fpu_cpu = NULL;
+}
+
+/* Called when switching from `prev` to `next`. Saves the state of `prev` if it
+ * used the FPU, and makes the next FPU instruction trap, unless the state of
+ * `next` is still loaded. A thread that migrated here may still be the owner
+ * of this CPU while its state was loaded elsewhere since, the copy in memory
+ * is then the current one.
+ */
+void fpu_switch(thread_t* prev, const thread_t* next) {
+    cpu_t* cpu = cpu_current();
+
+    if (prev && cpu->fpu_owner == prev && prev->fpu_cpu == cpu) {
+        fpu_save(prev->fpu_state);
+    }
+
+    if (next == cpu->fpu_owner && next->fpu_cpu == cpu) {
+        asm volatile("clts");
+    } else {
+        fpu_set_ts();
+    }
 }
 
-/* Whatever process got interrupted last has its fpu state in kernel_fpu.
- * When this function is called, it is being switched away from, hence we save
- * kernel_fpu in that process's structure, and we load the next process's fpu
- * state into kernel_fpu, which will get picked up by fpu_kernel_exit soon
- * enough.
+/* Frees the FPU state of an exiting thread. No CPU may keep it as its owner,
+ * lest a new thread allocated at the same address be mistaken for it. Other
+ * CPUs only change their own owner, so an exchange is enough to not undo that.
  */
-void fpu_switch(process_t* prev, const process_t* next) {
-    memcpy(prev->fpu_registers, kernel_fpu, 512);
-    memcpy(kernel_fpu, next->fpu_registers, 512);
+void fpu_release(thread_t* thread) {
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        __sync_bool_compare_and_swap(&cpus[i].fpu_owner, thread, NULL);
+    }
+
+    kfree(thread->fpu_state);
+    thread->fpu_state = NULL;
 }
 
-// Save the FPU state and initialize it for kernel use
-void fpu_kernel_enter() {
-    asm volatile("fxsave (%0)\n"
-                 "fninit\n" ::"r"(kernel_fpu));
+static void fpu_save(void* state) {
+    uint32_t lo = fpu_features;
+    uint32_t hi = fpu_features >> 32;
+
+    switch (fpu_mode) {
+    case FPU_XSAVEOPT:
+        asm volatile("xsaveopt (%0)" ::"r"(state), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_XSAVE:
+        asm volatile("xsave (%0)" ::"r"(state), "a"(lo), "d"(hi) : "memory");
+        break;
+    default:
+        asm volatile("fxsave (%0)" ::"r"(state) : "memory");
+    }
 }
 
-// Restore the FPU state when exiting the kernel
-void fpu_kernel_exit() {
-    asm volatile("fxrstor (%0)" ::"r"(kernel_fpu));
+static void fpu_restore(void* state) {
+    uint32_t lo = fpu_features;
+    uint32_t hi = fpu_features >> 32;
+
+    if (fpu_mode == FPU_FXSAVE) {
+        asm volatile("fxrstor (%0)" ::"r"(state) : "memory");
+    } else {
+        asm volatile("xrstor (%0)" ::"r"(state), "a"(lo), "d"(hi) : "memory");
+    }
+}
+
+/* The current thread used the FPU while its state isn't loaded. The state of
+ * the previous owner was saved when it was switched out, so we only have to
+ * load the current thread's.
+ */
+void fpu_not_available_handler(REGISTERS* regs) {
+    unused(regs);
+
+    cpu_t* cpu = cpu_current();
+    thread_t* thread = cpu->current;
+
+    asm volatile("clts");
+
+    if (cpu->fpu_owner == thread && thread->fpu_cpu == cpu) {
+        return;
+    }
+
+    fpu_restore(thread->fpu_state);
+    cpu->fpu_owner = thread;
+    thread->fpu_cpu = cpu;
 }
 
 // Handler for FPU exceptions
 void fpu_exception_handler(REGISTERS* regs) {
     unused(regs);
     kprintf("An FPU exception occurred");
-}
\ No newline at end of file
+}
@@ -1,15 +1,10 @@
 #include "kernel/cpu/gdt.h"
 
+#include "kernel/cpu/cpu.h"
 #include "kernel/cpu/tss.h"
 
-// Global GDT array with the specified number of descriptors
-GDT g_gdt[NO_GDT_DESCRIPTORS];
-
-// GDT pointer that holds the limit and base address of the GDT
-GDT_PTR g_gdt_ptr;
-
-void gdt_set_entry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
-    GDT* this = &g_gdt[index];
+void gdt_set_entry(GDT* gdt, int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    GDT* this = &gdt[index];
 
     this->segment_limit = limit & 0xFFFF;                       // Lower 16 bits of limit
     this->base_low = base & 0xFFFF;                             // Lower 16 bits of base
@@ -19,28 +14,52 @@ void gdt_set_entry(int index, uint32_t base, uint32_t limit, uint8_t access, uin
     this->base_high = (base >> 24) & 0xFF;                      // Highest 8 bits of base
 }
 
-void init_gdt() {
+/* Fills in the GDT of a CPU and loads it along with its TSS. Each CPU has its
+ * own, as the TSS holds the kernel stack and the per-CPU data segment points
+ * to that CPU's data.
+ */
+void gdt_init_cpu(GDT* gdt, GDT_PTR* gdt_ptr, tss_entry_t* tss, uintptr_t percpu, uint32_t percpu_size) {
     // Set GDT limit and base address
-    g_gdt_ptr.limit = sizeof(g_gdt) - 1;
-    g_gdt_ptr.base_address = (uint32_t) g_gdt;
+    gdt_ptr->limit = NO_GDT_DESCRIPTORS * sizeof(GDT) - 1;
+    gdt_ptr->base_address = (uint32_t) gdt;
 
     // Null segment
-    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(gdt, 0, 0, 0, 0, 0);
 
     // Kernel code segment
-    gdt_set_entry(1, 0, 0xFFFFFFFF, GDT_ACCESS_KERNEL_CODE, GDT_GRAND_FLAGS);
+    gdt_set_entry(gdt, 1, 0, 0xFFFFFFFF, GDT_ACCESS_KERNEL_CODE, GDT_GRAND_FLAGS);
     // Kernel data segment
-    gdt_set_entry(2, 0, 0xFFFFFFFF, GDT_ACCESS_KERNEL_DATA, GDT_GRAND_FLAGS);
+    gdt_set_entry(gdt, 2, 0, 0xFFFFFFFF, GDT_ACCESS_KERNEL_DATA, GDT_GRAND_FLAGS);
     // User code segment
-    gdt_set_entry(3, 0, 0xFFFFFFFF, GDT_ACCESS_USER_CODE, GDT_GRAND_FLAGS);
+    gdt_set_entry(gdt, 3, 0, 0xFFFFFFFF, GDT_ACCESS_USER_CODE, GDT_GRAND_FLAGS);
     // User data segment
-    gdt_set_entry(4, 0, 0xFFFFFFFF, GDT_ACCESS_USER_DATA, GDT_GRAND_FLAGS);
+    gdt_set_entry(gdt, 4, 0, 0xFFFFFFFF, GDT_ACCESS_USER_DATA, GDT_GRAND_FLAGS);
 
     // Initialize Task State Segment (TSS)
-    write_tss(5, 0x10, 0x0);
+    write_tss(gdt, tss, 5, 0x10, 0x0);
+
+    // Per-CPU data segment, byte granular
+    gdt_set_entry(gdt, 6, percpu, percpu_size - 1, GDT_ACCESS_KERNEL_DATA, GDT_GRAND_32BIT);
+
+    // Thread-local storage segment, reloaded on each context switch
+    gdt_set_tls(gdt, 0);
 
     // Load the GDT into the CPU
-    load_gdt((uint32_t) &g_gdt_ptr);
+    load_gdt((uint32_t) gdt_ptr);
     // Load the TSS
     load_tss();
 }
+
+/* Same as the user data segment, but based at the thread's TLS area. Its
+ * limit wraps around, for negative offsets to work too. The segment is cached
+ * when %gs is loaded, which happens when returning to userspace.
+ */
+void gdt_set_tls(GDT* gdt, uintptr_t base) {
+    gdt_set_entry(gdt, GDT_TLS_ENTRY, base, 0xFFFFFFFF, GDT_ACCESS_USER_DATA, GDT_GRAND_FLAGS);
+}
+
+/* Sets up the boot processor's GDT.
+ */
+void init_gdt() {
+    cpu_init(&cpus[0]);
+}
@@ -0,0 +1,81 @@
+#include "kernel/cpu/hpet.h"
+
+#include "kernel/cpu/clocksource.h"
+#include "kernel/mem/paging.h"
+#include "kernel/utils/debug.h"
+
+static volatile uint32_t* registers;
+static uint64_t frequency;
+
+static clocksource_t hpet_clocksource = {
+    .name = "hpet",
+    .read = hpet_read,
+    .mask = 0xFFFFFFFF,
+    .rating = 250,
+};
+
+static uint32_t hpet_get(uint32_t offset) {
+    return registers[offset / 4];
+}
+
+static void hpet_set(uint32_t offset, uint32_t value) {
+    registers[offset / 4] = value;
+}
+
+/* Finds the HPET through ACPI, starts its main counter and registers it as a
+ * clocksource.
+ */
+void init_hpet() {
+    acpi_hpet_t* table = (acpi_hpet_t*) acpi_find_table("HPET");
+
+    if (!table || table->address.space_id != 0) {
+        return;
+    }
+
+    registers = paging_map_mmio(table->address.address, 0x400, PAGE_RW | PAGE_NOCACHE);
+
+    // The upper half holds the counter period in femtoseconds
+    uint32_t period = hpet_get(HPET_CAP + 4);
+
+    if (!period || period > 100000000) {
+        kprintf_error("invalid HPET period %d fs", period);
+        registers = NULL;
+        return;
+    }
+
+    frequency = 1000000000000000ull / period;
+
+    if (hpet_get(HPET_CAP) & HPET_CAP_COUNT_64) {
+        hpet_clocksource.mask = 0xFFFFFFFFFFFFFFFF;
+    }
+
+    hpet_set(HPET_CONF, hpet_get(HPET_CONF) | HPET_CONF_ENABLE);
+
+    clocksource_register(&hpet_clocksource, frequency);
+}
+
+bool hpet_available() {
+    return registers != NULL;
+}
+
+/* Reads the main counter. The two halves of a 64-bit counter are read
+ * separately, so we retry if the upper half changed in between.
+ */
+uint64_t hpet_read() {
+    if (hpet_clocksource.mask == 0xFFFFFFFF) {
+        return hpet_get(HPET_COUNTER);
+    }
+
+    uint32_t hi, lo;
+
+    do {
+        hi = hpet_get(HPET_COUNTER + 4);
+        lo = hpet_get(HPET_COUNTER);
+    } while (hi != hpet_get(HPET_COUNTER + 4));
+
+    return ((uint64_t) hi << 32) | lo;
+}
+
+uint64_t hpet_frequency() {
+    return frequency;
+}
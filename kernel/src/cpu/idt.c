@@ -75,7 +75,31 @@ void init_idt() {
     idt_set_entry(47, (uint32_t) irq_15, 0x08, IDT_FLAGS);
     idt_set_entry(48, (uint32_t) irq_16, 0x08, IDT_FLAGS | IDT_RING3);
     idt_set_entry(128, (uint32_t) exception_128, 0x08, IDT_FLAGS | IDT_RING3);
+    idt_set_entry(67, (uint32_t) irq_67, 0x08, IDT_FLAGS);
+    idt_set_entry(68, (uint32_t) irq_68, 0x08, IDT_FLAGS);
+    idt_set_entry(69, (uint32_t) irq_69, 0x08, IDT_FLAGS);
+    idt_set_entry(70, (uint32_t) irq_70, 0x08, IDT_FLAGS);
+    idt_set_entry(71, (uint32_t) irq_71, 0x08, IDT_FLAGS);
+    idt_set_entry(95, (uint32_t) irq_95, 0x08, IDT_FLAGS);
+    idt_set_entry(110, (uint32_t) irq_110, 0x08, IDT_FLAGS);
+    idt_set_entry(125, (uint32_t) irq_125, 0x08, IDT_FLAGS);
+    idt_set_entry(140, (uint32_t) irq_140, 0x08, IDT_FLAGS);
+    idt_set_entry(155, (uint32_t) irq_155, 0x08, IDT_FLAGS);
+    idt_set_entry(170, (uint32_t) irq_170, 0x08, IDT_FLAGS);
+    idt_set_entry(185, (uint32_t) irq_185, 0x08, IDT_FLAGS);
+    idt_set_entry(200, (uint32_t) irq_200, 0x08, IDT_FLAGS);
+    idt_set_entry(209, (uint32_t) irq_209, 0x08, IDT_FLAGS);
+    idt_set_entry(224, (uint32_t) irq_224, 0x08, IDT_FLAGS);
+    idt_set_entry(240, (uint32_t) irq_240, 0x08, IDT_FLAGS);
+    idt_set_entry(241, (uint32_t) irq_241, 0x08, IDT_FLAGS);
+    idt_set_entry(255, (uint32_t) irq_255, 0x08, IDT_FLAGS);
 
-    load_idt((uint32_t) &g_idt_ptr);
+    idt_load();
     enable_interrupts();
 }
+
+/* Loads the IDT on the executing CPU. The table is shared by all CPUs.
+ */
+void idt_load() {
+    load_idt((uint32_t) &g_idt_ptr);
+}
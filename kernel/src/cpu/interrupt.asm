@@ -4,22 +4,24 @@ section .text
 
 exception_handler:
     pusha                 ; push all registers
-    mov ax, ds
-    push eax              ; save ds
-    
+    push ds               ; save segment registers
+    push es
+    push fs
+    push gs
+
     mov ax, 0x10          ; load kernel data segment
     mov ds, ax
     mov es, ax
-    mov fs, ax
     mov gs, ax
+    mov ax, 0x30          ; per-CPU data segment, see `cpu_current`
+    mov fs, ax
 
     call isr_exception_handler
 
-    pop ebx             ; restore kernel data segment
-    mov ds, bx
-    mov es, bx
-    mov fs, bx
-    mov gs, bx
+    pop gs              ; restore segment registers
+    pop fs
+    pop es
+    pop ds
 
     popa                ; restore all registers
     add esp, 0x8        ; restore stack for erro no been pushed
@@ -81,24 +83,26 @@ exception_noerr 128
 
 irq_handler:
     pusha                 ; push all registers
-    mov ax, ds
-    push eax              ; save ds
+    push ds               ; save segment registers
+    push es
+    push fs
+    push gs
 
     mov ax, 0x10          ; load kernel data segment
     mov ds, ax
     mov es, ax
-    mov fs, ax
     mov gs, ax
+    mov ax, 0x30          ; per-CPU data segment, see `cpu_current`
+    mov fs, ax
 
     push esp
     call isr_irq_handler
     pop esp
 
-    pop ebx                ; restore kernel data segment
-    mov ds, bx
-    mov es, bx
-    mov fs, bx
-    mov gs, bx
+    pop gs                 ; restore segment registers
+    pop fs
+    pop es
+    pop ds
 
     popa                ; restore all registers
     add esp, 0x8        ; restore stack for erro no been pushed
@@ -112,7 +116,7 @@ irq_handler:
   irq_%1:
     cli
     push byte 0
-    push byte %2
+    push dword %2
     jmp irq_handler
 %endmacro
 
@@ -135,6 +139,30 @@ IRQ 14, 46
 IRQ 15, 47
 IRQ 16, 48
 
+; ISA IRQs delivered through the I/O APIC, named after their vector, see
+; `ioapic_vector`
+IRQ 67, 67
+IRQ 68, 68
+IRQ 69, 69
+IRQ 70, 70
+IRQ 71, 71
+IRQ 95, 95
+IRQ 110, 110
+IRQ 125, 125
+IRQ 140, 140
+IRQ 155, 155
+IRQ 170, 170
+IRQ 185, 185
+IRQ 200, 200
+IRQ 209, 209
+IRQ 224, 224
+
+; Inter-processor interrupts, the local APIC timer and the local APIC's
+; spurious interrupt, named after their vector
+IRQ 240, 240
+IRQ 241, 241
+IRQ 255, 255
+
 ; jumped to on first context switch
 global irq_handler_end
 irq_handler_end:
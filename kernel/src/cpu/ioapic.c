@@ -0,0 +1,192 @@
+#include "kernel/cpu/ioapic.h"
+
+#include "kernel/boot/acpi.h"
+#include "kernel/boot/cmdline.h"
+#include "kernel/cpu/8259_pic.h"
+#include "kernel/cpu/cpu.h"
+#include "kernel/cpu/lapic.h"
+#include "kernel/mem/paging.h"
+#include "kernel/sys/spinlock.h"
+#include "kernel/utils/debug.h"
+
+typedef struct {
+    volatile uint32_t* registers;
+    uint32_t gsi_base;
+    uint32_t gsi_count;
+} ioapic_t;
+
+static ioapic_t ioapics[IOAPIC_MAX];
+static uint32_t ioapic_count;
+
+// Global system interrupt and redirection flags of each ISA IRQ
+static uint32_t isa_gsi[IOAPIC_ISA_IRQS];
+static uint32_t isa_flags[IOAPIC_ISA_IRQS];
+
+// Register accesses take two steps, see `ioapic_read`
+static spinlock_t ioapic_lock = SPINLOCK_INIT;
+
+/* Vector of each ISA IRQ. The local APIC orders vectors by class of 16, the
+ * high nibble, which we give out in the order of priority of the PIC's lines:
+ * 0, 1, 8 to 15, then 3 to 7, which have to share the lowest class for lack of
+ * room between the exceptions and the system call vector, and the local
+ * APIC's own vectors. The low nibble is the IRQ, see `ioapic_vector_irq`.
+ * Each vector has its own stub, see `interrupt.asm`.
+ */
+static const uint8_t isa_vectors[IOAPIC_ISA_IRQS] = {
+    0xE0, 0xD1, 0x00, 0x43, 0x44, 0x45, 0x46, 0x47, 0xC8, 0xB9, 0xAA, 0x9B, 0x8C, 0x7D, 0x6E, 0x5F};
+
+static uint32_t ioapic_read(ioapic_t* ioapic, uint32_t reg) {
+    ioapic->registers[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->registers[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t* ioapic, uint32_t reg, uint32_t value) {
+    ioapic->registers[IOAPIC_REGSEL / 4] = reg;
+    ioapic->registers[IOAPIC_WINDOW / 4] = value;
+}
+
+/* Returns the I/O APIC handling `gsi`, or NULL if none does.
+ */
+static ioapic_t* ioapic_find(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapic_t* ioapic = &ioapics[i];
+
+        if (gsi >= ioapic->gsi_base && gsi < ioapic->gsi_base + ioapic->gsi_count) {
+            return ioapic;
+        }
+    }
+
+    return NULL;
+}
+
+/* Translates the polarity and trigger mode of an interrupt source override to
+ * redirection entry flags. ISA interrupts are active high and edge triggered
+ * unless told otherwise.
+ */
+static uint32_t ioapic_override_flags(uint16_t flags) {
+    uint32_t entry = 0;
+
+    if ((flags & ACPI_MADT_POLARITY_MASK) == ACPI_MADT_POLARITY_LOW) {
+        entry |= IOAPIC_ACTIVE_LOW;
+    }
+
+    if ((flags & ACPI_MADT_TRIGGER_MASK) == ACPI_MADT_TRIGGER_LEVEL) {
+        entry |= IOAPIC_LEVEL;
+    }
+
+    return entry;
+}
+
+/* Points the redirection entry of ISA IRQ `irq` to its vector, see
+ * `isa_vectors`, on the boot processor.
+ */
+static void ioapic_route(uint32_t irq, bool masked) {
+    ioapic_t* ioapic = ioapic_find(isa_gsi[irq]);
+
+    if (!ioapic) {
+        return;
+    }
+
+    uint32_t reg = IOAPIC_REDIRECTION + (isa_gsi[irq] - ioapic->gsi_base) * 2;
+    uint32_t low = isa_vectors[irq] | isa_flags[irq] | (masked ? IOAPIC_MASKED : 0);
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+
+    ioapic_write(ioapic, reg + 1, cpus[0].apic_id << 24);
+    ioapic_write(ioapic, reg, low);
+
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+/* Switches interrupt delivery from the 8259 PIC to the I/O APICs listed in the
+ * MADT, which forward ISA IRQs to the boot processor's local APIC. Their
+ * vectors change, handlers stay registered for those of the PIC, see
+ * `isr_irq_handler`. Without an I/O APIC, or with `noapic` on the command line, we
+ * stick to the PIC. Must be called after `init_smp`, which sets up the local
+ * APIC.
+ */
+void init_ioapic() {
+    acpi_madt_t* madt = (acpi_madt_t*) acpi_find_table("APIC");
+
+    if (!madt || !lapic_available() || cmdline_get("noapic")) {
+        kprintf_info("using the 8259 PIC");
+        return;
+    }
+
+    acpi_madt_entry_t* entry = NULL;
+
+    while ((entry = acpi_madt_next(madt, entry, ACPI_MADT_IOAPIC))) {
+        acpi_madt_ioapic_t* madt_ioapic = (acpi_madt_ioapic_t*) entry;
+
+        if (ioapic_count == IOAPIC_MAX) {
+            kprintf_error("too many I/O APICs, only using %d", IOAPIC_MAX);
+            break;
+        }
+
+        ioapic_t* ioapic = &ioapics[ioapic_count++];
+        ioapic->registers = paging_map_mmio(madt_ioapic->address, 0x20, PAGE_RW | PAGE_NOCACHE);
+        ioapic->gsi_base = madt_ioapic->gsi_base;
+        ioapic->gsi_count = ((ioapic_read(ioapic, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+
+        // Everything is masked until routed
+        for (uint32_t i = 0; i < ioapic->gsi_count; i++) {
+            ioapic_write(ioapic, IOAPIC_REDIRECTION + i * 2, IOAPIC_MASKED);
+        }
+    }
+
+    if (!ioapic_count) {
+        kprintf_info("no I/O APIC, using the 8259 PIC");
+        return;
+    }
+
+    for (uint32_t irq = 0; irq < IOAPIC_ISA_IRQS; irq++) {
+        isa_gsi[irq] = irq;
+        isa_flags[irq] = 0;
+    }
+
+    entry = NULL;
+
+    while ((entry = acpi_madt_next(madt, entry, ACPI_MADT_OVERRIDE))) {
+        acpi_madt_override_t* override = (acpi_madt_override_t*) entry;
+
+        if (override->bus == 0 && override->source < IOAPIC_ISA_IRQS) {
+            isa_gsi[override->source] = override->gsi;
+            isa_flags[override->source] = ioapic_override_flags(override->flags);
+        }
+    }
+
+    pic8259_disable();
+
+    // IRQ 2 is the cascade of the slave PIC, it never fires
+    for (uint32_t irq = 0; irq < IOAPIC_ISA_IRQS; irq++) {
+        if (irq != 2) {
+            ioapic_route(irq, false);
+        }
+    }
+
+    kprintf_info("using %d I/O APIC(s)", ioapic_count);
+}
+
+bool ioapic_available() {
+    return ioapic_count != 0;
+}
+
+/* Returns the vector ISA IRQ `irq` is delivered on through the I/O APIC.
+ */
+uint32_t ioapic_vector(uint32_t irq) {
+    return isa_vectors[irq];
+}
+
+/* Returns the ISA IRQ delivered on `vector` through the I/O APIC, or -1 if
+ * it's not one of theirs.
+ */
+int32_t ioapic_vector_irq(uint32_t vector) {
+    uint32_t irq = vector & 0xF;
+
+    return irq != 2 && isa_vectors[irq] == vector ? (int32_t) irq : -1;
+}
+
+/* Masks or unmasks ISA IRQ `irq`.
+ */
+void ioapic_set_masked(uint32_t irq, bool masked) {
+    ioapic_route(irq, masked);
+}
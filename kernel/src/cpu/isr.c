@@ -3,8 +3,19 @@
 #include "kernel/cpu/8259_pic.h"
 #include "kernel/cpu/gdt.h"
 #include "kernel/cpu/idt.h"
+#include "kernel/cpu/ioapic.h"
+#include "kernel/cpu/lapic.h"
 #include "kernel/kernel.h"
 #include "kernel/lib/kprintf.h"
+#include "kernel/sys/preempt.h"
+#include "kernel/sys/proc.h"
+#include "kernel/sys/softirq.h"
+
+// Kernel stack bytes an interrupt handler may use, counting those it nests in
+#define ISR_STACK_RESERVE 1024
+
+#define ISR_IRQ_BASE 32
+#define ISR_IRQ_END 48 // Also the system call vector, see `syscall.c`
 
 // For both exceptions and irq interrupt
 ISR g_interrupt_handlers[NO_INTERRUPT_HANDLERS];
@@ -25,16 +36,161 @@ void isr_register_handler(int num, ISR handler) {
     g_interrupt_handlers[num] = handler;
 }
 
+/* Returns the ISA IRQ interrupt `int_no` was delivered for, or -1 if it isn't
+ * a device interrupt. The vectors depend on the controller, see
+ * `ioapic_vector`.
+ */
+static int32_t isr_irq_line(uint32_t int_no) {
+    if (ioapic_available()) {
+        return ioapic_vector_irq(int_no);
+    }
+
+    return int_no >= ISR_IRQ_BASE && int_no < ISR_IRQ_END ? (int32_t) (int_no - ISR_IRQ_BASE) : -1;
+}
+
+/* Acknowledges interrupt `int_no`, for ISA IRQ `irq` or -1, to whichever
+ * controller delivered it. Software interrupts, such as system calls, and
+ * spurious interrupts of the local APIC must not be acknowledged.
+ */
+static void isr_eoi(uint32_t int_no, int32_t irq) {
+    if (irq >= 0) {
+        // The I/O APIC forwards IRQs to the local APIC, a single MMIO write
+        // acknowledges them
+        if (ioapic_available()) {
+            lapic_eoi();
+        } else {
+            pic8259_eoi(int_no);
+        }
+    } else if (int_no >= LAPIC_VECTOR_BASE && int_no != LAPIC_SPURIOUS_VECTOR) {
+        lapic_eoi();
+    }
+}
+
+/* Device interrupts run with interrupts enabled once acknowledged, so that
+ * those of a higher priority aren't held back by them. Lines of the same or a
+ * lower priority are masked in the meantime: through the task priority of the
+ * local APIC, which orders vectors by class of 16, the I/O APIC giving lines
+ * classes in the PIC's order, or through the PIC masks. IRQs 3 to 7 share a
+ * class, and don't nest over each other with the I/O APIC. The local APIC's
+ * vectors, the timer and IPIs, are short and of the highest priority, they
+ * run with interrupts disabled.
+ */
+
+// PIC lines from the highest priority to the lowest, the slave's cascading
+// through line 2 of the master
+static const uint8_t pic_priorities[15] = {0, 1, 8, 9, 10, 11, 12, 13, 14, 15, 3, 4, 5, 6, 7};
+
+/* Masks the lines that mustn't interrupt the handler of `int_no`, delivered
+ * for ISA IRQ `irq`. Returns what to pass to `isr_restore_priority` once it's
+ * done.
+ */
+static uint32_t isr_raise_priority(uint32_t int_no, uint32_t irq) {
+    if (ioapic_available()) {
+        uint32_t tpr = lapic_get_tpr();
+
+        lapic_set_tpr(int_no & 0xF0);
+        return tpr;
+    }
+
+    uint16_t mask = pic8259_get_mask();
+    uint16_t lower = 0;
+    uint32_t i = 0;
+
+    while (i < sizeof(pic_priorities) && pic_priorities[i] != irq) {
+        i++;
+    }
+
+    for (; i < sizeof(pic_priorities); i++) {
+        lower |= 1 << pic_priorities[i];
+    }
+
+    pic8259_set_mask(mask | lower);
+
+    return mask;
+}
+
+static void isr_restore_priority(uint32_t saved) {
+    if (ioapic_available()) {
+        lapic_set_tpr(saved);
+    } else {
+        pic8259_set_mask(saved);
+    }
+}
+
+/* Interrupt handlers run on the kernel stack of the thread they interrupted,
+ * which nested ones could overflow into whatever lies below it.
+ */
+static void isr_check_stack(cpu_t* cpu) {
+    thread_t* thread = cpu->current;
+
+    // Boot stacks and the threads standing for them aren't checked
+    if (!thread || !thread->kernel_stack) {
+        return;
+    }
+
+    uintptr_t esp = (uintptr_t) __builtin_frame_address(0);
+    uintptr_t bottom = thread->kernel_stack + 4 - PROC_KERNEL_STACK_PAGES * 0x1000;
+
+    if (esp < bottom + ISR_STACK_RESERVE) {
+        kprintf_error("kernel stack overflow: %d bytes left at interrupt depth %d\n",
+            (int32_t) (esp - bottom), cpu->irq_depth);
+        abort();
+    }
+}
+
 /**
- * invoke isr routine and send eoi to pic,
+ * send eoi to pic or local apic and invoke isr routine,
  * being called in irq.asm
  */
 void isr_irq_handler(REGISTERS* reg) {
-    if (g_interrupt_handlers[reg->int_no] != NULL) {
-        ISR handler = g_interrupt_handlers[reg->int_no];
+    uint32_t int_no = reg->int_no;
+    int32_t irq = isr_irq_line(int_no);
+    cpu_t* cpu = cpu_current();
+
+    // Device handlers are registered for the PIC's vectors, whichever
+    // controller delivers them
+    ISR handler = g_interrupt_handlers[irq >= 0 ? (uint32_t) (ISR_IRQ_BASE + irq) : int_no];
+
+    // Acknowledge first: the handler may switch to another process, and only
+    // return here once this one gets scheduled again
+    isr_eoi(int_no, irq);
+
+    // System calls come through here too, but don't count as interrupts, so
+    // that those they get can preempt them
+    if (int_no != ISR_IRQ_END) {
+        isr_check_stack(cpu);
+        cpu->irq_depth++;
+    }
+
+    if (irq >= 0) {
+        uint32_t saved = isr_raise_priority(int_no, irq);
+
+        enable_interrupts();
+
+        if (handler) {
+            handler(reg);
+        }
+
+        disable_interrupts();
+        isr_restore_priority(saved);
+    } else if (handler) {
         handler(reg);
     }
-    pic8259_eoi(reg->int_no);
+
+    if (int_no != ISR_IRQ_END) {
+        cpu->irq_depth--;
+    }
+
+    // The handler may have left work for later, or asked for the interrupted
+    // thread to be preempted, which can only be done now that it's finished
+    softirq_run();
+    preempt_check_resched();
+
+    // The thread may have work of its own to do before going back to
+    // userspace, which can block
+    if ((reg->cs & 3) == 3) {
+        proc_user_work();
+    }
 }
 
 static void print_registers(REGISTERS* reg) {
@@ -49,17 +205,16 @@ static void print_registers(REGISTERS* reg) {
 }
 
 /**
- * invoke exception routine,
+ * invoke exception routine, or halt on unhandled exceptions,
  * being called in exception.asm
  */
 void isr_exception_handler(REGISTERS reg) {
-    if (reg.int_no < 32) {
-        kprintf("EXCEPTION: %s\n", exception_messages[reg.int_no]);
-        print_registers(&reg);
-        infinite_loop();
-    }
     if (g_interrupt_handlers[reg.int_no] != NULL) {
         ISR handler = g_interrupt_handlers[reg.int_no];
         handler(&reg);
+    } else if (reg.int_no < 32) {
+        kprintf("EXCEPTION: %s\n", exception_messages[reg.int_no]);
+        print_registers(&reg);
+        infinite_loop();
     }
 }
@@ -0,0 +1,105 @@
+#include "kernel/cpu/lapic.h"
+
+#include "kernel/cpu/clocksource.h"
+#include "kernel/mem/paging.h"
+#include "kernel/sys/spinlock.h"
+
+/* Each CPU sees its own local APIC at the same address */
+static volatile uint32_t* registers;
+
+static uint32_t lapic_get(uint32_t offset) {
+    return registers[offset / 4];
+}
+
+static void lapic_set(uint32_t offset, uint32_t value) {
+    registers[offset / 4] = value;
+}
+
+/* Maps the local APIC registers found at `phys`, and enables the local APIC of
+ * the boot processor.
+ */
+void init_lapic(uintptr_t phys) {
+    registers = paging_map_mmio(phys, 0x400, PAGE_RW | PAGE_NOCACHE);
+    lapic_enable();
+}
+
+bool lapic_available() {
+    return registers != NULL;
+}
+
+/* Software enables the local APIC of the executing CPU, and lets every
+ * interrupt priority through.
+ */
+void lapic_enable() {
+    lapic_set(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_set(LAPIC_TPR, 0);
+}
+
+uint32_t lapic_id() {
+    return lapic_get(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi() {
+    lapic_set(LAPIC_EOI, 0);
+}
+
+/* The task priority of the executing CPU: interrupts whose vector is in the
+ * same class of 16 vectors as the priority, or in a lower one, are held back.
+ */
+uint32_t lapic_get_tpr() {
+    return lapic_get(LAPIC_TPR);
+}
+
+void lapic_set_tpr(uint32_t priority) {
+    lapic_set(LAPIC_TPR, priority);
+}
+
+/* Sends an inter-processor interrupt to the CPU with the given APIC id, once
+ * the previous one was accepted. The command is written in two steps, which
+ * an interrupt handler sending its own IPI mustn't come between.
+ */
+void lapic_send_ipi(uint32_t apic_id, uint32_t command) {
+    uint32_t flags = irq_save();
+
+    while (lapic_get(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        asm volatile("pause");
+    }
+
+    lapic_set(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_set(LAPIC_ICR_LOW, command);
+    irq_restore(flags);
+}
+
+/* Measures the frequency of the local APIC timer against the monotonic clock,
+ * in Hz. Every CPU's timer is assumed to tick at the same rate, that of the
+ * bus clock divided by 16.
+ */
+uint32_t lapic_timer_calibrate() {
+    lapic_set(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_set(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+
+    uint64_t start = clock_monotonic_ns();
+    lapic_set(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+
+    clock_delay_ns(10000000);
+
+    uint32_t counts = 0xFFFFFFFF - lapic_get(LAPIC_TIMER_CURRENT);
+    uint64_t elapsed = clock_monotonic_ns() - start;
+
+    lapic_set(LAPIC_TIMER_INITIAL, 0);
+
+    return (uint64_t) counts * NS_PER_SEC / elapsed;
+}
+
+/* Arms the local APIC timer of the executing CPU to interrupt us after
+ * `counts` counts, and every `counts` counts thereafter if `periodic`.
+ */
+void lapic_timer_start(uint32_t counts, bool periodic) {
+    lapic_set(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_set(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | (periodic ? LAPIC_TIMER_PERIODIC : 0));
+    lapic_set(LAPIC_TIMER_INITIAL, counts ? counts : 1);
+}
+
+void lapic_timer_stop() {
+    lapic_set(LAPIC_TIMER_INITIAL, 0);
+}
@@ -0,0 +1,13 @@
+#include "kernel/cpu/msr.h"
+
+uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+
+    asm volatile("rdmsr\n" : "=a"(lo), "=d"(hi) : "c"(msr));
+
+    return ((uint64_t) hi << 32) | lo;
+}
+
+void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr\n" ::"a"((uint32_t) value), "d"((uint32_t) (value >> 32)), "c"(msr));
+}
@@ -1,9 +1,13 @@
 #include "kernel/cpu/serial.h"
 
+#include "kernel/cpu/isr.h"
 #include "kernel/cpu/ports.h"
+#include "kernel/kernel.h"
 
 #define SERIAL_PORT_COM1 0x3F8
 
+static void (*rx_handler)(char);
+
 int serial_received() {
     return inportb(SERIAL_PORT_COM1 + 5) & 1;
 }
@@ -32,4 +36,25 @@ void init_serial() {
     outportb(SERIAL_PORT_COM1 + 3, 0x03); // 8 bits, no parity, one stop bit
     outportb(SERIAL_PORT_COM1 + 2, 0xC7); // Enable FIFO, clear them, with 14-byte threshold
     outportb(SERIAL_PORT_COM1 + 4, 0x0B); // IRQs enabled, RTS/DSR set
+}
+
+static void serial_irq_handler(REGISTERS* regs) {
+    unused(regs);
+
+    while (serial_received()) {
+        char c = inportb(SERIAL_PORT_COM1);
+
+        if (rx_handler) {
+            rx_handler(c);
+        }
+    }
+}
+
+/* Has `handler` called from the interrupt handler with every byte received.
+ */
+void serial_set_rx_handler(void (*handler)(char)) {
+    rx_handler = handler;
+
+    isr_register_handler(36, serial_irq_handler); // IRQ 4
+    outportb(SERIAL_PORT_COM1 + 1, 0x01);          // Data available interrupt
 }
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "kernel/cpu/smp.h"
+
+#include "kernel/boot/acpi.h"
+#include "kernel/boot/cmdline.h"
+#include "kernel/cpu/clocksource.h"
+#include "kernel/cpu/fpu.h"
+#include "kernel/cpu/idt.h"
+#include "kernel/cpu/timer.h"
+#include "kernel/kernel.h"
+#include "kernel/mem/malloc.h"
+#include "kernel/mem/paging.h"
+#include "kernel/sys/proc.h"
+#include "kernel/sys/syscall.h"
+#include "kernel/utils/debug.h"
+#include "libc/string.h"
+
+// Defined in trampoline.asm
+extern uint8_t smp_trampoline_start;
+extern uint8_t smp_trampoline_end;
+extern uint8_t smp_trampoline_cr3;
+extern uint8_t smp_trampoline_stack;
+extern uint8_t smp_trampoline_cpu;
+
+/* Lists the processors described by the MADT, and sets up the local APIC of
+ * the boot processor. Without a MADT, or with `nosmp` on the command line, we
+ * stick to the boot processor. Must be called before `init_proc`, which sets
+ * up a run queue per CPU.
+ */
+void init_smp() {
+    acpi_madt_t* madt = (acpi_madt_t*) acpi_find_table("APIC");
+
+    cpus[0].online = true;
+
+    if (!madt) {
+        kprintf_info("no MADT, running on a single CPU");
+        return;
+    }
+
+    init_lapic(madt->lapic_addr);
+    cpus[0].apic_id = lapic_id();
+
+    if (cmdline_get("nosmp")) {
+        return;
+    }
+
+    acpi_madt_entry_t* entry = NULL;
+
+    while ((entry = acpi_madt_next(madt, entry, ACPI_MADT_LAPIC))) {
+        acpi_madt_lapic_t* lapic = (acpi_madt_lapic_t*) entry;
+
+        if (!(lapic->flags & (ACPI_MADT_LAPIC_ENABLED | ACPI_MADT_LAPIC_ONLINE_CAPABLE))) {
+            continue;
+        }
+
+        if (lapic->apic_id == cpus[0].apic_id) {
+            continue;
+        }
+
+        if (cpu_count == CPU_MAX) {
+            kprintf_error("too many CPUs, only using %d", CPU_MAX);
+            break;
+        }
+
+        cpu_t* cpu = &cpus[cpu_count];
+        cpu->self = cpu;
+        cpu->id = cpu_count++;
+        cpu->apic_id = lapic->apic_id;
+    }
+
+    kprintf_info("%d CPUs found", cpu_count);
+}
+
+static void smp_trampoline_set(uint8_t* symbol, uint32_t value) {
+    uintptr_t offset = symbol - &smp_trampoline_start;
+
+    *(uint32_t*) (PHYS_TO_VIRT(SMP_TRAMPOLINE) + offset) = value;
+}
+
+/* Waits up to `ns` nanoseconds for `cpu` to come online.
+ */
+static bool smp_wait_online(cpu_t* cpu, uint64_t ns) {
+    uint64_t end = clock_monotonic_ns() + ns;
+
+    while (!cpu->online) {
+        if (clock_monotonic_ns() >= end) {
+            return false;
+        }
+
+        asm volatile("pause");
+    }
+
+    return true;
+}
+
+/* Starts the application processors one at a time, with the INIT-SIPI-SIPI
+ * sequence. They share the trampoline, so each must be done with it before
+ * the next one starts.
+ */
+void smp_start_aps() {
+    if (cpu_count == 1) {
+        return;
+    }
+
+    uint32_t size = &smp_trampoline_end - &smp_trampoline_start;
+    memcpy((void*) PHYS_TO_VIRT(SMP_TRAMPOLINE), &smp_trampoline_start, size);
+    smp_trampoline_set(&smp_trampoline_cr3, paging_get_kernel_directory());
+
+    for (uint32_t i = 1; i < cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+        uintptr_t stack = (uintptr_t) kamalloc(SMP_AP_STACK_SIZE, 16);
+
+        smp_trampoline_set(&smp_trampoline_stack, stack + SMP_AP_STACK_SIZE);
+        smp_trampoline_set(&smp_trampoline_cpu, (uintptr_t) cpu);
+
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+        clock_delay_ns(10000000);
+
+        // A second startup IPI is only needed if the first one got lost
+        for (uint32_t tries = 0; tries < 2 && !cpu->online; tries++) {
+            lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | (SMP_TRAMPOLINE >> 12));
+            smp_wait_online(cpu, 200000);
+        }
+
+        // Give up on this CPU and the next ones, which would share its stack
+        // and trampoline if it woke up late
+        if (!smp_wait_online(cpu, 100000000)) {
+            kprintf_error("CPU %d (APIC id %d) didn't start", i, cpu->apic_id);
+            cpu_count = i;
+            break;
+        }
+    }
+}
+
+/* Asks `cpu` to run its scheduler, see `proc_reschedule_handler`.
+ */
+void smp_send_reschedule(cpu_t* cpu) {
+    if (!lapic_available() || !cpu->online) {
+        return;
+    }
+
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | SMP_IPI_RESCHEDULE);
+}
+
+/* Where application processors land after the trampoline, on their boot stack.
+ * They set up their own descriptor tables, FPU, local APIC, timer and system
+ * call entry, then go idle until there's work to steal.
+ */
+void ap_main(cpu_t* cpu) {
+    cpu_init(cpu);
+    idt_load();
+    fpu_init_cpu();
+    lapic_enable();
+    timer_init_cpu();
+    syscall_init_cpu();
+
+    kprintf_info("CPU %d online, APIC id %d", cpu->id, cpu->apic_id);
+    cpu->online = true;
+
+    proc_enter_usermode();
+}
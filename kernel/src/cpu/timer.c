@@ -1,47 +1,497 @@
-
 #include "kernel/cpu/timer.h"
 
+#include "kernel/boot/cmdline.h"
+#include "kernel/cpu/clocksource.h"
+#include "kernel/cpu/cpu.h"
+#include "kernel/cpu/ioapic.h"
 #include "kernel/cpu/isr.h"
+#include "kernel/cpu/lapic.h"
 #include "kernel/cpu/ports.h"
 #include "kernel/lib/kprintf.h"
+#include "kernel/mem/malloc.h"
+#include "kernel/sys/hrtimer.h"
+#include "kernel/sys/preempt.h"
+#include "kernel/sys/softirq.h"
+#include "kernel/sys/spinlock.h"
+#include "kernel/sys/wheel.h"
+#include "kernel/utils/debug.h"
+#include "libc/math.h"
+#include "libc/string.h"
 
 // Globals are always initialized to 0
 static uint32_t current_tick;
-ISR callback;
+
+/* Called on every timer interrupt, in the order they were registered, see
+ * `timer_register_callback`. The list is only ever appended to, so the
+ * interrupt walks it without a lock.
+ */
+typedef struct _timer_callback_t {
+    ISR handler;
+    struct _timer_callback_t* next;
+} timer_callback_t;
+
+static timer_callback_t* callbacks;
+
+/* In dynamic tick mode, the PIT is programmed in one-shot mode for the next
+ * tick something has to happen at, instead of interrupting us on every tick.
+ * The callback deadline, see `timer_set_deadline`, is that of the boot
+ * processor, the only one the PIT interrupts.
+ */
+static bool oneshot;
+// PIT counts of the pending one-shot event, zero if none
+static uint32_t programmed;
+// PIT counts elapsed since the last tick boundary
+static uint32_t sub_tick;
+
+/* Once interrupts go through the I/O APIC, every CPU gets its own local APIC
+ * timer, and the PIT is left alone. Ticks are then derived from the monotonic
+ * clock, counting from `lapic_base_tick` at `lapic_base_ns`. Timers of the
+ * wheel and high resolution timers are still run by the boot processor only,
+ * the latter at the exact time they expire. With the PIT, they expire on the
+ * following tick.
+ */
+static bool lapic_mode;
+static uint32_t lapic_freq; // In Hz
+static uint32_t lapic_max_ticks;
+static uint32_t lapic_base_tick;
+static uint64_t lapic_base_ns;
+// Time the boot processor's next event is programmed for, see `timer_update`
+static uint64_t boot_programmed_ns;
+
+// Protects the PIT and the state above, which any CPU may read the time from
+static spinlock_t timer_lock = SPINLOCK_INIT;
+
+static void timer_program_next(uint32_t ticks);
+static bool timer_softirq(uint32_t budget);
 
 void init_timer() {
-    uint32_t divisor = TIMER_QUOTIENT / TIMER_FREQ;
+    const char* nohz = cmdline_get("nohz");
+    oneshot = !nohz || strcmp(nohz, "off");
 
-    outportb(PIT_CMD, PIT_SET);
-    outportb(PIT_0, divisor & 0xFF);
-    outportb(PIT_0, (divisor >> 8) & 0xFF);
+    if (oneshot) {
+        kprintf_info("dynamic ticks enabled");
+        timer_program_next(TIMER_ONESHOT_MAX_TICKS);
+    } else {
+        uint32_t divisor = TIMER_COUNTS_PER_TICK;
+
+        outportb(PIT_CMD, PIT_SET);
+        outportb(PIT_0, divisor & 0xFF);
+        outportb(PIT_0, (divisor >> 8) & 0xFF);
+    }
 
     isr_register_handler(32, &timer_callback);
+    softirq_register(SOFTIRQ_TIMER, timer_softirq, TIMER_SOFTIRQ_BUDGET);
+}
+
+/* Returns how many PIT counts of the pending one-shot event have elapsed.
+ */
+static uint32_t timer_elapsed() {
+    if (!programmed) {
+        return 0;
+    }
+
+    // Latch both the status and the count of channel 0
+    outportb(PIT_CMD, PIT_READBACK);
+    uint8_t status = inportb(PIT_0);
+    uint32_t count = inportb(PIT_0);
+    count |= inportb(PIT_0) << 8;
+
+    // The output pin goes high once the count reaches zero, after which the
+    // counter wraps around and keeps going
+    if (status & PIT_STATUS_OUT || count > programmed) {
+        return programmed;
+    }
+
+    return programmed - count;
+}
+
+/* Accounts for the time covered by the pending one-shot event, which is
+ * considered cancelled afterwards.
+ */
+static void timer_sync() {
+    sub_tick += timer_elapsed();
+    programmed = 0;
+
+    current_tick += sub_tick / TIMER_COUNTS_PER_TICK;
+    sub_tick %= TIMER_COUNTS_PER_TICK;
+}
+
+/* Returns in how many ticks the next high resolution timer expires, rounding
+ * up, or `TIMER_ONESHOT_MAX_TICKS` if there's none, for `timer_program_next`.
+ * Called without `timer_lock`, which reading the clock may take.
+ */
+static uint32_t timer_hrtimer_ticks() {
+    uint64_t expires;
+
+    if (!hrtimer_next_expiry(&expires)) {
+        return TIMER_ONESHOT_MAX_TICKS;
+    }
+
+    uint64_t now = clock_monotonic_ns();
+
+    if (expires <= now) {
+        return 1;
+    }
+
+    return min(timer_ns_to_ticks(expires - now), TIMER_ONESHOT_MAX_TICKS);
+}
+
+/* Programs a one-shot event for the earliest of the next timer expiry, the
+ * callback deadline and `ticks`. Events always land on a tick boundary, and
+ * are at most as long as the PIT allows, so that we still notice the time
+ * passing.
+ */
+static void timer_program_next(uint32_t ticks) {
+    uint32_t expires;
+
+    if (cpus[0].timer_has_deadline) {
+        ticks = min(ticks, max(cpus[0].timer_deadline - current_tick, 1));
+    }
+
+    if (wheel_next_expiry(&expires)) {
+        ticks = min(ticks, max(expires - current_tick, 1));
+    }
+
+    programmed = ticks * TIMER_COUNTS_PER_TICK - sub_tick;
+
+    outportb(PIT_CMD, PIT_ONESHOT);
+    outportb(PIT_0, programmed & 0xFF);
+    outportb(PIT_0, (programmed >> 8) & 0xFF);
+}
+
+static uint32_t timer_lapic_tick(uint64_t ns) {
+    return lapic_base_tick + (ns - lapic_base_ns) / TIMER_NS_PER_TICK;
+}
+
+static uint64_t timer_lapic_tick_ns(uint32_t tick) {
+    return lapic_base_ns + (uint64_t) (tick - lapic_base_tick) * TIMER_NS_PER_TICK;
+}
+
+/* Arms the local APIC timer of `cpu`, the executing CPU, for the earliest of
+ * its deadline and, on the boot processor, the next timer expiry. As time is
+ * kept by the clocksource, the timer is simply left stopped when there's
+ * nothing to wait for.
+ */
+static void timer_lapic_program(cpu_t* cpu) {
+    uint64_t now_ns = clock_monotonic_ns();
+    uint32_t now = timer_lapic_tick(now_ns);
+    uint32_t ticks = lapic_max_ticks;
+    uint32_t expires;
+    uint64_t hr_expires;
+    bool armed = false;
+
+    if (cpu->timer_has_deadline) {
+        ticks = min(ticks, max(cpu->timer_deadline - now, 1));
+        armed = true;
+    }
+
+    if (cpu->id == 0 && wheel_next_expiry(&expires)) {
+        ticks = min(ticks, max(expires - now, 1));
+        armed = true;
+    }
+
+    uint64_t target_ns = timer_lapic_tick_ns(now + ticks);
+
+    // High resolution timers don't wait for a tick boundary
+    if (cpu->id == 0 && hrtimer_next_expiry(&hr_expires)) {
+        hr_expires = hr_expires > now_ns + HRTIMER_MIN_DELTA_NS ? hr_expires : now_ns + HRTIMER_MIN_DELTA_NS;
+        target_ns = hr_expires < target_ns ? hr_expires : target_ns;
+        armed = true;
+    }
+
+    if (cpu->id == 0) {
+        boot_programmed_ns = armed ? target_ns : UINT64_MAX;
+    }
+
+    if (!armed) {
+        lapic_timer_stop();
+        return;
+    }
+
+    uint32_t counts = (target_ns - now_ns) * lapic_freq / NS_PER_SEC;
+    lapic_timer_start(counts ? counts : 1, false);
+}
+
+/* Reprograms the local APIC timer of the executing CPU. The boot processor
+ * does so under `timer_lock`, for other CPUs to tell whether it'll notice the
+ * timers they add in time.
+ */
+static void timer_lapic_update(cpu_t* cpu) {
+    if (cpu->id == 0) {
+        uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+        timer_lapic_program(cpu);
+        spin_unlock_irqrestore(&timer_lock, flags);
+    } else {
+        uint32_t flags = irq_save();
+
+        timer_lapic_program(cpu);
+        irq_restore(flags);
+    }
+}
+
+/* Hands timekeeping over from the PIT to the monotonic clock, and interrupts
+ * from the PIT to the local APIC timers. Needs the I/O APIC, to keep the PIT
+ * quiet, and a clocksource that doesn't depend on the timer itself.
+ */
+static void timer_switch_lapic() {
+    if (!ioapic_available() || clock_is_jiffies()) {
+        return;
+    }
+
+    lapic_freq = lapic_timer_calibrate();
+    lapic_max_ticks = 0xFFFFFFFF / (lapic_freq / TIMER_FREQ);
+
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    ioapic_set_masked(0, true);
+
+    if (oneshot) {
+        timer_sync();
+    }
+
+    lapic_base_tick = current_tick;
+    lapic_base_ns = clock_monotonic_ns();
+    lapic_mode = true;
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    isr_register_handler(LAPIC_TIMER_VECTOR, &timer_callback);
+    kprintf_info("using the local APIC timers, %d kHz", lapic_freq / 1000);
+}
+
+/* Sets up the timer of the executing CPU. The boot processor starts off with
+ * the PIT, and switches to its local APIC timer here when it can. Other CPUs
+ * then get timer interrupts of their own, and none otherwise.
+ */
+void timer_init_cpu() {
+    cpu_t* cpu = cpu_current();
+
+    if (cpu->id == 0 && !lapic_mode) {
+        timer_switch_lapic();
+    }
+
+    if (!lapic_mode) {
+        return;
+    }
+
+    if (oneshot) {
+        timer_lapic_update(cpu);
+    } else {
+        lapic_timer_start(lapic_freq / TIMER_FREQ, true);
+    }
+}
+
+static void timer_run_callbacks(REGISTERS* regs) {
+    timer_callback_t* callback = __atomic_load_n(&callbacks, __ATOMIC_ACQUIRE);
+
+    for (; callback; callback = __atomic_load_n(&callback->next, __ATOMIC_ACQUIRE)) {
+        callback->handler(regs);
+    }
 }
 
 void timer_callback(REGISTERS* regs) {
-    current_tick++;
+    if (lapic_mode) {
+        cpu_t* cpu = cpu_current();
 
-    if (callback) {
-        callback(regs);
+        if (cpu->id == 0) {
+            softirq_raise(SOFTIRQ_TIMER);
+        }
+
+        if (oneshot) {
+            timer_lapic_update(cpu);
+        }
+
+        timer_run_callbacks(regs);
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    if (oneshot) {
+        // The interrupt may be stale if we reprogrammed the PIT meanwhile, in
+        // which case this only accounts for part of the event
+        timer_sync();
+    } else {
+        current_tick++;
     }
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    softirq_raise(SOFTIRQ_TIMER);
+    timer_update();
+    timer_run_callbacks(regs);
 }
 
-uint32_t timer_get_tick() {
-    return current_tick;
+/* Runs the timers of the wheel and the high resolution timers expired by now,
+ * at most `budget` of each. Timers they add may be due before the event
+ * programmed by the interrupt.
+ */
+static bool timer_softirq(uint32_t budget) {
+    bool more = wheel_run(timer_get_tick(), budget);
+
+    more |= hrtimer_run(clock_monotonic_ns(), budget);
+    timer_update();
+
+    return more;
 }
 
-/* Returns the time since boot in seconds
+/* Returns the number of ticks since boot. In dynamic tick mode, the time spent
+ * in the pending event is read back from the PIT.
  */
-double timer_get_time() {
-    return current_tick * (1.0 / TIMER_FREQ);
+uint32_t timer_get_tick() {
+    if (lapic_mode) {
+        return timer_lapic_tick(clock_monotonic_ns());
+    }
+
+    if (!oneshot) {
+        return current_tick;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    uint32_t tick = current_tick + (sub_tick + timer_elapsed()) / TIMER_COUNTS_PER_TICK;
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    return tick;
 }
 
+/* Has `handler` called from every timer interrupt, after the tick was
+ * accounted for. Meant for work that must happen on each CPU's tick, timers
+ * being the way to do something at a given time.
+ */
 void timer_register_callback(ISR handler) {
-    if (callback) {
-        kprintf("[TIMER] Callback already registered");
-        kprintf("[TIMER] Add support for multiple callbacks!");
-    } else {
-        callback = handler;
+    timer_callback_t* callback = kmalloc(sizeof(timer_callback_t));
+    timer_callback_t** link = &callbacks;
+
+    *callback = (timer_callback_t) {.handler = handler};
+
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    while (*link) {
+        link = &(*link)->next;
+    }
+
+    __atomic_store_n(link, callback, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+/* Arms the wheel timer `timer` to expire at tick `timer->expires`, see
+ * `wheel_add`, and makes sure the boot processor, which runs timers, notices
+ * it in time. The boot processor itself reprograms its timer when scheduling,
+ * and after running timers.
+ */
+void timer_add(wheel_timer_t* timer) {
+    preempt_disable();
+    wheel_add(timer);
+
+    if (cpu_current()->id != 0) {
+        timer_update();
     }
+
+    preempt_enable();
+}
+
+/* Same as `timer_add`, for tick `expires`. Returns whether the timer was
+ * pending.
+ */
+bool timer_mod(wheel_timer_t* timer, uint32_t expires) {
+    preempt_disable();
+    bool pending = wheel_mod(timer, expires);
+
+    if (cpu_current()->id != 0) {
+        timer_update();
+    }
+
+    preempt_enable();
+
+    return pending;
+}
+
+/* Disarms `timer`, and returns whether it was pending. */
+bool timer_del(wheel_timer_t* timer) {
+    return wheel_del(timer);
+}
+
+/* Makes sure the timer callback runs within `ticks` ticks on the executing
+ * CPU, or only when a timer expires if `ticks` is zero. Used by the scheduler
+ * to get a tick when the current process's quantum ends. Without dynamic
+ * ticks, the callback runs on every tick anyway. Without local APIC timers,
+ * only the boot processor gets timer interrupts at all.
+ */
+void timer_set_deadline(uint32_t ticks) {
+    if (!oneshot) {
+        return;
+    }
+
+    cpu_t* cpu = cpu_current();
+
+    if (lapic_mode) {
+        cpu->timer_has_deadline = ticks != 0;
+        cpu->timer_deadline = timer_get_tick() + ticks;
+
+        timer_lapic_update(cpu);
+        return;
+    }
+
+    if (cpu->id != 0) {
+        return;
+    }
+
+    uint32_t hr_ticks = timer_hrtimer_ticks();
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    timer_sync();
+
+    cpu->timer_has_deadline = ticks != 0;
+    cpu->timer_deadline = current_tick + ticks;
+
+    timer_program_next(hr_ticks);
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+/* Reprograms the next event, for timers added since it was programmed to be
+ * noticed in time. With local APIC timers, other CPUs wake up the boot
+ * processor if the new timer expires before its next event.
+ */
+void timer_update() {
+    if (!oneshot) {
+        return;
+    }
+
+    if (!lapic_mode) {
+        uint32_t hr_ticks = timer_hrtimer_ticks();
+        uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+        timer_sync();
+        timer_program_next(hr_ticks);
+        spin_unlock_irqrestore(&timer_lock, flags);
+        return;
+    }
+
+    cpu_t* cpu = cpu_current();
+
+    if (cpu->id == 0) {
+        timer_lapic_update(cpu);
+        return;
+    }
+
+    uint32_t expires;
+    uint64_t hr_expires;
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    bool early = wheel_next_expiry(&expires) && timer_lapic_tick_ns(expires) < boot_programmed_ns;
+
+    early = early || (hrtimer_next_expiry(&hr_expires) && hr_expires < boot_programmed_ns);
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    if (early) {
+        lapic_send_ipi(cpus[0].apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | LAPIC_TIMER_VECTOR);
+    }
+}
+
+/* Converts a duration to timer ticks, rounding up.
+ */
+uint32_t timer_ns_to_ticks(uint64_t ns) {
+    return (ns + TIMER_NS_PER_TICK - 1) / TIMER_NS_PER_TICK;
 }
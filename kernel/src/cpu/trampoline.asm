@@ -0,0 +1,87 @@
+; Startup code of the application processors. `smp_start_aps` copies it to
+; SMP_TRAMPOLINE and fills in its data, then points the startup IPI there.
+; Processors start in real mode, so we go through protected mode and paging
+; the same way `boot.asm` does, then jump to `ap_main` in the higher half.
+
+section .text
+extern ap_main
+
+%define SMP_TRAMPOLINE 0x8000
+
+; Address of `x` once the trampoline is copied
+%define REL(x) (SMP_TRAMPOLINE + (x) - smp_trampoline_start)
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_cr3
+global smp_trampoline_stack
+global smp_trampoline_cpu
+
+BITS 16
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    lgdt [REL(trampoline_gdt_ptr)]
+
+    ; Enable protected mode
+    mov eax, cr0
+    or eax, 0x1
+    mov cr0, eax
+
+    jmp dword 0x08:REL(trampoline_protected)
+
+BITS 32
+trampoline_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor ax, ax
+    mov fs, ax
+    mov gs, ax
+
+    ; Enable PSE for the 4 MiB page mapping the kernel
+    mov eax, cr4
+    or eax, 0x00000010
+    mov cr4, eax
+
+    ; Use the kernel's page directory, which identity maps low memory
+    mov eax, [REL(smp_trampoline_cr3)]
+    mov cr3, eax
+
+    ; Enable paging, and write protection in kernel mode as on the BSP
+    mov eax, cr0
+    or eax, 0x80010000
+    mov cr0, eax
+
+    mov esp, [REL(smp_trampoline_stack)]
+    mov ebp, 0            ; Stop stack traces here
+
+    ; ap_main(cpu), which never returns
+    push dword [REL(smp_trampoline_cpu)]
+    push dword 0
+    mov eax, ap_main
+    jmp eax
+
+; Flat code and data segments, replaced by the CPU's own GDT in `ap_main`
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+trampoline_gdt_ptr:
+    dw trampoline_gdt_ptr - trampoline_gdt - 1
+    dd REL(trampoline_gdt)
+
+; Filled in by `smp_start_aps` before each startup IPI
+align 4
+smp_trampoline_cr3:
+    dd 0
+smp_trampoline_stack:
+    dd 0
+smp_trampoline_cpu:
+    dd 0
+smp_trampoline_end:
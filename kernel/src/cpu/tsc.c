@@ -0,0 +1,89 @@
+#include "kernel/cpu/tsc.h"
+
+#include "kernel/cpu/clocksource.h"
+#include "kernel/cpu/cpuid.h"
+#include "kernel/cpu/hpet.h"
+#include "kernel/cpu/ports.h"
+#include "kernel/cpu/timer.h"
+#include "kernel/utils/debug.h"
+
+static uint64_t frequency;
+
+static clocksource_t tsc_clocksource = {
+    .name = "tsc",
+    .read = tsc_read,
+    .mask = 0xFFFFFFFFFFFFFFFF,
+    .rating = 100,
+};
+
+uint64_t tsc_read() {
+    uint32_t lo, hi;
+
+    asm volatile("rdtsc\n" : "=a"(lo), "=d"(hi));
+
+    return ((uint64_t) hi << 32) | lo;
+}
+
+/* Counts TSC cycles while the HPET runs for `TSC_CALIBRATION_MS`.
+ */
+static uint64_t tsc_calibrate_hpet() {
+    uint32_t hpet_wait = hpet_frequency() * TSC_CALIBRATION_MS / 1000;
+    uint64_t hpet_start = hpet_read();
+    uint64_t tsc_start = tsc_read();
+    uint32_t hpet_elapsed;
+
+    // Differences are taken on 32 bits, in case the HPET counter is 32-bit
+    do {
+        hpet_elapsed = hpet_read() - hpet_start;
+    } while (hpet_elapsed < hpet_wait);
+
+    uint64_t tsc_end = tsc_read();
+
+    return (tsc_end - tsc_start) * hpet_frequency() / hpet_elapsed;
+}
+
+/* Counts TSC cycles while channel 2 of the PIT, the speaker one, counts down
+ * for `TSC_CALIBRATION_MS`. Polling its output doesn't need interrupts.
+ */
+static uint64_t tsc_calibrate_pit() {
+    uint32_t count = TIMER_QUOTIENT * TSC_CALIBRATION_MS / 1000;
+
+    // Enable the channel 2 gate, keep the speaker off
+    outportb(PIT_GATE, (inportb(PIT_GATE) & ~PIT_GATE_SPEAKER) | PIT_GATE_ENABLE);
+
+    // Channel 2, lobyte/hibyte, interrupt on terminal count
+    outportb(PIT_CMD, 0xB0);
+    outportb(PIT_2, count & 0xFF);
+    outportb(PIT_2, (count >> 8) & 0xFF);
+
+    uint64_t tsc_start = tsc_read();
+
+    while (!(inportb(PIT_GATE) & PIT_GATE_OUT)) {
+    }
+
+    uint64_t tsc_end = tsc_read();
+
+    return (tsc_end - tsc_start) * 1000 / TSC_CALIBRATION_MS;
+}
+
+/* Calibrates the TSC against the HPET if there's one, the PIT otherwise, and
+ * registers it as a clocksource. It's only preferred to the HPET if it ticks
+ * at a constant rate whatever the power state.
+ */
+void init_tsc() {
+    if (!(cpuid(1, 0).edx & CPUID_EDX_TSC)) {
+        return;
+    }
+
+    frequency = hpet_available() ? tsc_calibrate_hpet() : tsc_calibrate_pit();
+
+    if (cpuid_has_leaf(0x80000007) && cpuid(0x80000007, 0).edx & CPUID_EXT_EDX_INVARIANT_TSC) {
+        tsc_clocksource.rating = 300;
+    }
+
+    clocksource_register(&tsc_clocksource, frequency);
+}
+
+uint64_t tsc_frequency() {
+    return frequency;
+}
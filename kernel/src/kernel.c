@@ -1,10 +1,15 @@
 #include "kernel/kernel.h"
 
+#include "kernel/boot/acpi.h"
+#include "kernel/boot/cmdline.h"
 #include "kernel/boot/multiboot2.h"
+#include "kernel/cpu/clocksource.h"
 #include "kernel/cpu/fpu.h"
 #include "kernel/cpu/gdt.h"
 #include "kernel/cpu/idt.h"
+#include "kernel/cpu/ioapic.h"
 #include "kernel/cpu/serial.h"
+#include "kernel/cpu/smp.h"
 #include "kernel/cpu/timer.h"
 #include "kernel/lib/fb.h"
 #include "kernel/lib/kprintf.h"
@@ -12,23 +17,68 @@
 #include "kernel/mem/paging.h"
 #include "kernel/mem/pmm.h"
 #include "kernel/sys/proc.h"
+#include "kernel/sys/softirq.h"
 #include "kernel/sys/syscall.h"
+#include "kernel/sys/workqueue.h"
 #include "libc/math.h"
 #include "libc/string.h"
 
+/* A GRUB module copied to the heap, see `kernel_module_data` */
+typedef struct _kernel_module_t {
+    struct _kernel_module_t* next;
+    const char* name;
+    uint8_t* data;
+} kernel_module_t;
+
+static kernel_module_t* kernel_modules;
+
+/* Returns a copy of the contents of `mod` in kernel memory. Modules of the
+ * same name share a single copy, which identifies the executable to the ELF
+ * loader, so that instances of a program share its read-only pages, see
+ * `elf_load`. Copies are kept for as long as the kernel runs.
+ */
+static uint8_t* kernel_module_data(mb2_tag_module_t* mod) {
+    const char* name = (const char*) mod->name;
+    uint32_t size = mod->mod_end - mod->mod_start;
+
+    for (kernel_module_t* module = kernel_modules; module; module = module->next) {
+        if (!strcmp(module->name, name)) {
+            return module->data;
+        }
+    }
+
+    kernel_module_t* module = kmalloc(sizeof(kernel_module_t));
+
+    module->name = name;
+    module->data = kmalloc(size);
+    memcpy(module->data, (void*) mod->mod_start, size);
+    module->next = kernel_modules;
+    kernel_modules = module;
+
+    return module->data;
+}
+
 void kernel_main(mb2_t* boot, uint32_t magic) {
     init_serial();
+    init_cmdline(boot);
     init_fpu();
     init_gdt();
     init_idt();
     init_timer();
     init_pmm(boot);
     init_paging(boot);
+    init_acpi(boot);
+    init_clocksource();
+    init_smp();
+    init_ioapic();
+    timer_init_cpu();
 
     init_fb(boot);
     set_text_color(vga_to_color(15), vga_to_color(0));
 
     init_proc();
+    init_workqueue();
+    init_softirq();
     init_syscall();
 
     if (magic != MB2_MAGIC) {
@@ -46,11 +96,17 @@ void kernel_main(mb2_t* boot, uint32_t magic) {
             uint32_t size = mod->mod_end - mod->mod_start;
             char* module_name = (char*) mod->name;
 
-            uint8_t* data = (uint8_t*) kmalloc(size);
-            memcpy(data, (void*) mod->mod_start, size);
+            uint8_t* data = kernel_module_data(mod);
 
             if (!strcmp(module_name, "program1")) {
-                proc_run_code(data, size, NULL);
+                // Instances after the first only take frames for their private
+                // pages, page tables and stack
+                uint32_t used = pmm_used_memory();
+                process_t* process = proc_run_code(data, size, NULL);
+
+                if (process) {
+                    kprintf("started process %u, %u KiB of frames\n", process->pid, (pmm_used_memory() - used) / 1024);
+                }
             }
 
             kprintf("loaded module %s\n\n", mod->name);
@@ -60,6 +116,7 @@ void kernel_main(mb2_t* boot, uint32_t magic) {
     }
     set_font_scale(2);
 
+    smp_start_aps();
     proc_enter_usermode();
     infinite_loop();
 }
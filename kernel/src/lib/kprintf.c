@@ -3,6 +3,7 @@
 #include "kernel/cpu/serial.h"
 #include "kernel/lib/fb.h"
 #include "kernel/lib/font.h"
+#include "kernel/sys/spinlock.h"
 #include "libc/string.h"
 
 int font_scale = 1;
@@ -14,6 +15,11 @@ uint32_t back_color = 0xff000000;
 
 #define print_char(c) vbe_print_char(c)
 
+// Keeps CPUs from mixing up the cursor position. It's only held for a
+// character at a time, so that printing doesn't keep interrupts disabled for
+// long: lines printed at once by several CPUs may interleave.
+static spinlock_t print_lock = SPINLOCK_INIT;
+
 void set_pos_text(int x, int y) {
     pos_x = x;
     pos_x2 = pos_x;
@@ -49,7 +55,7 @@ void print_ch(char c) {
     }
 }
 
-void vbe_print_char(char c) {
+static void vbe_put_char(char c) {
     write_serial(c);
     if (c == '\n') {
         pos_y += GLYPH_HEIGHT * font_scale;
@@ -64,6 +70,13 @@ void vbe_print_char(char c) {
     }
 }
 
+void vbe_print_char(char c) {
+    uint32_t flags = spin_lock_irqsave(&print_lock);
+
+    vbe_put_char(c);
+    spin_unlock_irqrestore(&print_lock, flags);
+}
+
 void put_string(char* s) {
     uint32_t l = strlen(s);
     for (uint32_t i = 0; i < l; i++) {
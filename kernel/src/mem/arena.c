@@ -0,0 +1,114 @@
+#include "kernel/mem/arena.h"
+
+#include "kernel/mem/malloc.h"
+#include "kernel/utils/debug.h"
+#include "libc/math.h"
+#include "libc/string.h"
+
+/* Allocates a chunk able to hold at least `size` bytes, rounded up to whole
+ * pages, and chains it on top of `prev`.
+ */
+static arena_chunk_t* arena_new_chunk(arena_chunk_t* prev, uint32_t size) {
+    uint32_t num_pages = divide_up(size + sizeof(arena_chunk_t), 0x1000);
+    arena_chunk_t* chunk = kamalloc(num_pages * 0x1000, 0x1000);
+
+    chunk->prev = prev;
+    chunk->size = num_pages * 0x1000 - sizeof(arena_chunk_t);
+    chunk->used = 0;
+
+    return chunk;
+}
+
+/* Bumps `size` bytes out of `chunk`, returns NULL if it doesn't fit.
+ */
+static void* arena_chunk_alloc(arena_chunk_t* chunk, uint32_t size) {
+    uint32_t offset = align_to(chunk->used, ARENA_ALIGN);
+
+    if (offset + size > chunk->size) {
+        return NULL;
+    }
+
+    chunk->used = offset + size;
+
+    return (uint8_t*) chunk + sizeof(arena_chunk_t) + offset;
+}
+
+/* Creates an arena initially spanning `num_pages` pages. The arena structure
+ * itself lives in its first chunk, so creating and destroying an arena that
+ * never grows costs a single heap allocation and a single free.
+ */
+arena_t* arena_create(uint32_t num_pages) {
+    uint32_t size = max(num_pages, 1) * 0x1000 - sizeof(arena_chunk_t);
+    arena_chunk_t* chunk = arena_new_chunk(NULL, size);
+    arena_t* arena = arena_chunk_alloc(chunk, sizeof(arena_t));
+
+    arena->chunk = chunk;
+    arena->first = chunk;
+
+    return arena;
+}
+
+/* Returns `size` bytes of uninitialized memory from the arena, aligned to
+ * `ARENA_ALIGN`. The memory stays valid until the arena is reset to a prior
+ * mark or destroyed.
+ */
+void* arena_alloc(arena_t* arena, uint32_t size) {
+    void* ptr = arena_chunk_alloc(arena->chunk, size);
+
+    if (!ptr) {
+        // Grow by at least as much as the current chunk to amortize growth
+        uint32_t chunk_size = max(size + ARENA_ALIGN, arena->chunk->size);
+
+        arena->chunk = arena_new_chunk(arena->chunk, chunk_size);
+        ptr = arena_chunk_alloc(arena->chunk, size);
+    }
+
+    return ptr;
+}
+
+/* Copies `str` into the arena.
+ */
+char* arena_strdup(arena_t* arena, const char* str) {
+    uint32_t len = strlen(str);
+    char* copy = arena_alloc(arena, len + 1);
+
+    memcpy(copy, str, len + 1);
+
+    return copy;
+}
+
+/* Returns the current position of the arena, to be passed to `arena_reset`.
+ */
+arena_mark_t arena_mark(arena_t* arena) {
+    return (arena_mark_t) {.chunk = arena->chunk, .used = arena->chunk->used};
+}
+
+/* Releases everything allocated since `mark` was taken. Chunks added after
+ * that point are given back to the heap.
+ */
+void arena_reset(arena_t* arena, arena_mark_t mark) {
+    while (arena->chunk != mark.chunk) {
+        if (arena->chunk == arena->first) {
+            kprintf_error("arena mark doesn't belong to this arena");
+            abort();
+        }
+
+        arena_chunk_t* prev = arena->chunk->prev;
+        kfree(arena->chunk);
+        arena->chunk = prev;
+    }
+
+    arena->chunk->used = mark.used;
+}
+
+/* Frees the arena and every allocation made from it.
+ */
+void arena_destroy(arena_t* arena) {
+    arena_chunk_t* chunk = arena->chunk;
+
+    while (chunk) {
+        arena_chunk_t* prev = chunk->prev;
+        kfree(chunk);
+        chunk = prev;
+    }
+}
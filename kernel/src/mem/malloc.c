@@ -1,6 +1,8 @@
 #include "kernel/mem/malloc.h"
 
 #include "kernel/mem/paging.h"
+#include "kernel/sys/preempt.h"
+#include "kernel/sys/spinlock.h"
 #include "kernel/utils/debug.h"
 #include "libc/math.h"
 #include "libc/string.h"
@@ -19,6 +21,10 @@ static mem_block_t* bottom = NULL;
 static mem_block_t* top = NULL;
 static uint32_t used_memory = 0;
 
+// Protects the block list, shared by all CPUs. Never taken from interrupt
+// handlers, so it only needs preemption disabled, not interrupts.
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
 /* Debugging function to print the block list. Only sizes are listed, and a '#'
  * indicates a used block.
  */
@@ -156,9 +162,13 @@ void kfree(void* pointer) {
         return;
     }
 
+    preempt_disable();
+    spin_lock(&heap_lock);
     mem_block_t* block = mem_get_block(pointer);
     block->size &= ~1;
     used_memory -= block->size;
+    spin_unlock(&heap_lock);
+    preempt_enable();
 }
 
 /**
@@ -176,6 +186,9 @@ void* aligned_alloc(size_t align, size_t size) {
     const uint32_t header_size = offsetof(mem_block_t, data);
     size = align_to(size, 8);
 
+    preempt_disable();
+    spin_lock(&heap_lock);
+
     // If this is the first allocation, setup the block list:
     // it starts with an empty, used block, in order to avoid edge cases.
     if (!top) {
@@ -194,6 +207,8 @@ void* aligned_alloc(size_t align, size_t size) {
     if (block) {
         used_memory += block->size;
         block->size |= 1;
+        spin_unlock(&heap_lock);
+        preempt_enable();
 
         return block->data;
     } else {
@@ -211,6 +226,8 @@ void* aligned_alloc(size_t align, size_t size) {
     }
 
     used_memory += size;
+    spin_unlock(&heap_lock);
+    preempt_enable();
 
     return block->data;
 }
@@ -1,6 +1,7 @@
 #include "kernel/mem/paging.h"
 
 #include "kernel/cpu/serial.h"
+#include "kernel/sys/proc.h"
 #include "kernel/utils/debug.h"
 #include "libc/math.h"
 #include "libc/string.h"
@@ -8,6 +9,9 @@
 #define DIRECTORY_INDEX(x) ((x) >> 22)
 #define TABLE_INDEX(x) (((x) >> 12) & 0x3FF)
 
+// Exit status of processes killed by a page fault
+#define PAGING_FAULT_STATUS 0xFF
+
 static directory_entry_t* current_page_directory;
 
 extern directory_entry_t initial_page_dir[1024];
@@ -43,7 +47,7 @@ void init_paging(mb2_t* boot) {
  *
  * @return The physical address of the initial page directory.
  */
-uintptr_t paging_get_initial_page_dir() {
+uintptr_t paging_get_kernel_directory() {
     return VIRT_TO_PHYS((uintptr_t) &initial_page_dir);
 }
 
@@ -216,7 +220,8 @@ void paging_invalidate_page(uintptr_t virt) {
  * the fault (e.g., read/write, user/kernel mode). It also checks if the page
  * was present and if any reserved bits were overwritten. If the fault occurred
  * during an instruction fetch, this is also logged. Finally, the function
- * aborts the current process.
+ * aborts the current process. Faults on demand-zero user pages are resolved
+ * by mapping the page instead, see `proc_fault`.
  *
  * @param regs Pointer to the register state at the time of the fault.
  */
@@ -231,6 +236,15 @@ void paging_fault_handler(REGISTERS* regs) {
     uintptr_t cr2 = 0;
     asm volatile("mov %%cr2, %0\n" : "=r"(cr2));
 
+    // User pages mapped on demand, as .bss is
+    if (!(err & 0x01) && cr2 < KERNEL_BASE_VIRT && proc_fault(cr2)) {
+        return;
+    }
+
+    if (err & 0x04) {
+        pid = current_process->pid;
+    }
+
     kprintf_error("page fault caused by instruction at 0x%x from process %d:", regs->eip, pid);
     kprintf_error("the page at 0x%x %s present ", cr2, err & 0x01 ? "was" : "wasn't");
     kprintf_error("when a process tried to %s it", err & 0x02 ? "write to" : "read from");
@@ -252,6 +266,13 @@ void paging_fault_handler(REGISTERS* regs) {
         kprintf_error("The fault occured during an instruction fetch");
     }
 
+    // Faults from userspace, on guard pages for instance, only take down the
+    // faulting process
+    if (err & 0x04) {
+        kprintf_error("killing process %d", pid);
+        proc_exit_process(PAGING_FAULT_STATUS);
+    }
+
     abort();
 }
 
@@ -284,4 +305,27 @@ uintptr_t paging_virt_to_phys(uintptr_t virt) {
     }
 
     return (((uintptr_t) *p) & PAGE_FRAME) + (virt & 0xFFF);
-}
\ No newline at end of file
+}
+
+/* Maps the `size` bytes of physical memory at `phys` in the kernel's MMIO
+ * window, and returns their virtual address. Mappings are permanent. Page
+ * tables of the window are only shared with processes created afterwards, so
+ * devices must be mapped during boot.
+ */
+void* paging_map_mmio(uintptr_t phys, uint32_t size, uint32_t flags) {
+    static uintptr_t next = KERNEL_MMIO_BEGIN;
+
+    uintptr_t offset = phys & 0xFFF;
+    uint32_t num = divide_up(offset + size, 0x1000);
+
+    if (next + num * 0x1000 > KERNEL_MMIO_BEGIN + KERNEL_MMIO_SIZE) {
+        kprintf_error("MMIO window exhausted mapping 0x%x", phys);
+        abort();
+    }
+
+    uintptr_t virt = next;
+    paging_map_pages(virt, phys & PAGE_FRAME, num, flags);
+    next += num * 0x1000;
+
+    return (void*) (virt + offset);
+}
@@ -1,6 +1,8 @@
 #include "kernel/mem/pmm.h"
 
 #include "kernel/mem/paging.h"
+#include "kernel/sys/preempt.h"
+#include "kernel/sys/spinlock.h"
 #include "kernel/utils/debug.h"
 #include "libc/math.h"
 #include "libc/string.h"
@@ -13,6 +15,10 @@ static uint32_t used_blocks;
 static uint32_t max_blocks;
 static uintptr_t kernel_end;
 
+// Protects the bitmap once other CPUs run. Never taken from interrupt handlers,
+// so it only needs preemption disabled, not interrupts.
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
 void mmap_set(uint32_t bit);
 void mmap_unset(uint32_t bit);
 uint32_t mmap_test(uint32_t bit);
@@ -164,6 +170,9 @@ void pmm_deinit_region(uintptr_t addr, uint32_t size) {
  * @return The address of the allocated memory block, or 0 if no free block is found.
  */
 uintptr_t pmm_alloc_page() {
+    preempt_disable();
+    spin_lock(&pmm_lock);
+
     if (max_blocks - used_blocks <= 0) {
         kprintf_error("kernel is out of physical memory!");
         abort();
@@ -171,11 +180,12 @@ uintptr_t pmm_alloc_page() {
 
     uint32_t block = mmap_find_free();
 
-    if (!block) {
-        return 0;
+    if (block) {
+        mmap_set(block);
     }
 
-    mmap_set(block);
+    spin_unlock(&pmm_lock);
+    preempt_enable();
 
     return (uintptr_t) (block * PMM_BLOCK_SIZE);
 }
@@ -191,13 +201,17 @@ uintptr_t pmm_alloc_page() {
  *         allocation fails.
  */
 uintptr_t pmm_alloc_aligned_large_page() {     // TODO: generalize
-    if (max_blocks - used_blocks < 2 * 1024) { // 4MiB
-        return 0;
-    }
+    preempt_disable();
+    spin_lock(&pmm_lock);
+    uint32_t free_block = 0;
 
-    uint32_t free_block = mmap_find_free_frame(2 * 1024);
+    if (max_blocks - used_blocks >= 2 * 1024) { // 4MiB
+        free_block = mmap_find_free_frame(2 * 1024);
+    }
 
     if (!free_block) {
+        spin_unlock(&pmm_lock);
+        preempt_enable();
         return 0;
     }
 
@@ -207,6 +221,9 @@ uintptr_t pmm_alloc_aligned_large_page() {     // TODO: generalize
         mmap_set(aligned_block + i);
     }
 
+    spin_unlock(&pmm_lock);
+    preempt_enable();
+
     return (uintptr_t) (aligned_block * PMM_BLOCK_SIZE);
 }
 
@@ -220,20 +237,23 @@ uintptr_t pmm_alloc_aligned_large_page() {     // TODO: generalize
  * @return The starting address of the allocated pages, or 0 if allocation fails.
  */
 uintptr_t pmm_alloc_pages(uint32_t num) {
-    if (max_blocks - used_blocks < num) {
-        return 0;
-    }
-
-    uint32_t first_block = mmap_find_free_frame(num);
+    preempt_disable();
+    spin_lock(&pmm_lock);
+    uint32_t first_block = 0;
 
-    if (!first_block) {
-        return 0;
+    if (max_blocks - used_blocks >= num) {
+        first_block = mmap_find_free_frame(num);
     }
 
-    for (uint32_t i = 0; i < num; i++) {
-        mmap_set(first_block + i);
+    if (first_block) {
+        for (uint32_t i = 0; i < num; i++) {
+            mmap_set(first_block + i);
+        }
     }
 
+    spin_unlock(&pmm_lock);
+    preempt_enable();
+
     return (uintptr_t) (first_block * PMM_BLOCK_SIZE);
 }
 
@@ -245,8 +265,12 @@ uintptr_t pmm_alloc_pages(uint32_t num) {
  * @param addr The address of the page to free.
  */
 void pmm_free_page(uintptr_t addr) {
+    preempt_disable();
+    spin_lock(&pmm_lock);
     uint32_t block = addr / PMM_BLOCK_SIZE;
     mmap_unset(block);
+    spin_unlock(&pmm_lock);
+    preempt_enable();
 }
 
 /**
@@ -259,11 +283,16 @@ void pmm_free_page(uintptr_t addr) {
  * @param num The number of pages to free.
  */
 void pmm_free_pages(uintptr_t addr, uint32_t num) {
+    preempt_disable();
+    spin_lock(&pmm_lock);
     uint32_t first_block = addr / PMM_BLOCK_SIZE;
 
     for (uint32_t i = 0; i < num; i++) {
         mmap_unset(first_block + i);
     }
+
+    spin_unlock(&pmm_lock);
+    preempt_enable();
 }
 
 /**
@@ -0,0 +1,299 @@
+#include "kernel/sys/elf.h"
+
+#include "kernel/lib/kprintf.h"
+#include "kernel/mem/malloc.h"
+#include "kernel/mem/paging.h"
+#include "kernel/mem/pmm.h"
+#include "kernel/sys/preempt.h"
+#include "kernel/sys/ring.h"
+#include "kernel/sys/spinlock.h"
+#include "libc/math.h"
+#include "libc/string.h"
+
+/* Loads statically linked ELF32 executables. Only the file-backed part of
+ * PT_LOAD segments is copied; whole pages past it, .bss mostly, are left
+ * unmapped and zeroed on first access, see `proc_fault`. Read-only pages are
+ * only ever loaded once, see `elf_load`.
+ */
+
+// Segments may go anywhere between the null page and the ring
+#define ELF_USER_BEGIN 0x1000
+#define ELF_USER_END RING_USER_ADDR
+
+/* The read-only pages of an executable, in the order `elf_for_each_page`
+ * enumerates them. Entries are added before their frames are filled, which
+ * only the loader that added them may use until `ready` is set.
+ */
+typedef struct _elf_cache_t {
+    struct _elf_cache_t* next;
+    uint8_t* data;
+    bool ready;
+    uintptr_t frames[];
+} elf_cache_t;
+
+static elf_cache_t* elf_cache;
+
+// Protects the list of entries, taken before the heap and the PMM locks.
+// Never taken from interrupt handlers.
+static spinlock_t elf_cache_lock = SPINLOCK_INIT;
+
+static elf_phdr_t* elf_phdrs(uint8_t* data) {
+    return (elf_phdr_t*) (data + ((elf_header_t*) data)->phoff);
+}
+
+/* Returns whether the end of the segment's memory lies past the last page of
+ * its file contents, leaving pages to be zeroed on demand.
+ */
+static bool elf_has_zero_pages(elf_phdr_t* phdr) {
+    return align_to(phdr->vaddr + phdr->filesz, 0x1000) < phdr->vaddr + phdr->memsz;
+}
+
+/* Checks that `data` is an i386 executable that `elf_load` can map without
+ * reading past `size` bytes or touching kernel memory.
+ */
+bool elf_check(uint8_t* data, uint32_t size) {
+    elf_header_t* header = (elf_header_t*) data;
+
+    if (size < sizeof(elf_header_t) || header->magic != ELF_MAGIC || header->class != ELF_CLASS_32 ||
+        header->data != ELF_DATA_LSB || header->type != ELF_TYPE_EXEC || header->machine != ELF_MACHINE_386) {
+        kprintf_error("not an i386 ELF executable");
+        return false;
+    }
+
+    if (header->phentsize != sizeof(elf_phdr_t) || header->phoff > size ||
+        header->phnum > (size - header->phoff) / sizeof(elf_phdr_t)) {
+        kprintf_error("truncated ELF program headers");
+        return false;
+    }
+
+    elf_phdr_t* phdrs = elf_phdrs(data);
+    uint32_t num_zero_regions = 0;
+    bool entry_mapped = false;
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        elf_phdr_t* phdr = &phdrs[i];
+
+        if (phdr->type != ELF_PT_LOAD || !phdr->memsz) {
+            continue;
+        }
+
+        if (phdr->filesz > phdr->memsz || phdr->offset > size || phdr->filesz > size - phdr->offset) {
+            kprintf_error("ELF segment %d lies outside of the file", i);
+            return false;
+        }
+
+        if (phdr->vaddr < ELF_USER_BEGIN || phdr->vaddr > ELF_USER_END || phdr->memsz > ELF_USER_END - phdr->vaddr) {
+            kprintf_error("ELF segment %d lies outside of user memory", i);
+            return false;
+        }
+
+        num_zero_regions += elf_has_zero_pages(phdr);
+        entry_mapped |= header->entry >= phdr->vaddr && header->entry - phdr->vaddr < phdr->memsz;
+    }
+
+    if (num_zero_regions > PROC_ZERO_REGIONS) {
+        kprintf_error("too many ELF segments with zero-filled pages");
+        return false;
+    }
+
+    if (!entry_mapped) {
+        kprintf_error("ELF entry point 0x%x isn't in any segment", header->entry);
+        return false;
+    }
+
+    return true;
+}
+
+/* Returns whether the page at `virt` can be shared between processes, that
+ * is whether no writable segment covers it.
+ */
+static bool elf_page_shareable(uint8_t* data, uintptr_t virt) {
+    elf_header_t* header = (elf_header_t*) data;
+    elf_phdr_t* phdrs = elf_phdrs(data);
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        elf_phdr_t* phdr = &phdrs[i];
+
+        if (phdr->type != ELF_PT_LOAD || !phdr->memsz || !(phdr->flags & ELF_PF_W)) {
+            continue;
+        }
+
+        if (virt >= (phdr->vaddr & PAGE_FRAME) && virt < align_to(phdr->vaddr + phdr->memsz, 0x1000)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Calls `func` on each page backed by the file, in an order that only depends
+ * on `data`, with the segment it belongs to.
+ */
+static void elf_for_each_page(uint8_t* data, void (*func)(uint8_t*, elf_phdr_t*, uintptr_t, void*), void* arg) {
+    elf_header_t* header = (elf_header_t*) data;
+    elf_phdr_t* phdrs = elf_phdrs(data);
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        elf_phdr_t* phdr = &phdrs[i];
+
+        if (phdr->type != ELF_PT_LOAD || !phdr->memsz) {
+            continue;
+        }
+
+        uintptr_t file_end = align_to(phdr->vaddr + phdr->filesz, 0x1000);
+
+        for (uintptr_t virt = phdr->vaddr & PAGE_FRAME; virt < file_end; virt += 0x1000) {
+            func(data, phdr, virt, arg);
+        }
+    }
+}
+
+static void elf_count_page(uint8_t* data, elf_phdr_t* phdr, uintptr_t virt, void* arg) {
+    uint32_t* count = arg;
+
+    // Pages spanning two read-only segments are counted twice, no harm done
+    *count += elf_page_shareable(data, virt);
+}
+
+/* Copies the part of the file contents of `phdr` that falls in the page at
+ * `virt` to its frame `phys`. The copy goes through a temporary mapping: the
+ * page isn't in the current address space, and the kernel can't write to
+ * read-only user pages either.
+ */
+static void elf_fill_page(uint8_t* data, elf_phdr_t* phdr, uintptr_t virt, uintptr_t phys) {
+    // Not `min` and `max`, which compare signed integers
+    uintptr_t start = virt > phdr->vaddr ? virt : phdr->vaddr;
+    uintptr_t end = phdr->vaddr + phdr->filesz;
+
+    if (end > virt + 0x1000) {
+        end = virt + 0x1000;
+    }
+
+    if (start < end) {
+        uint8_t* page = proc_map_temp(0, phys);
+        memcpy(page + (start - virt), data + phdr->offset + (start - phdr->vaddr), end - start);
+    }
+}
+
+/* Returns a zeroed frame, bytes of the page not covered by the file end up
+ * zeroed.
+ */
+static uintptr_t elf_new_frame() {
+    uintptr_t phys = pmm_alloc_page();
+
+    memset(proc_map_temp(0, phys), 0, 0x1000);
+
+    return phys;
+}
+
+typedef struct {
+    elf_image_t* image;
+    uintptr_t directory;
+    elf_cache_t* cache; // NULL if read-only pages are private copies too
+    bool reuse;         // Whether `cache` was filled by a previous load
+    uint32_t next_shared;
+} elf_load_state_t;
+
+/* Maps a page of `phdr` and fills it, unless it's a shared page that another
+ * process already filled. Preemption is only disabled for that page.
+ */
+static void elf_load_page(uint8_t* data, elf_phdr_t* phdr, uintptr_t virt, void* arg) {
+    elf_load_state_t* state = arg;
+    uint32_t flags = PAGE_USER | (phdr->flags & ELF_PF_W ? PAGE_RW : 0);
+
+    preempt_disable();
+
+    // Filling frames reuses temporary mapping 0 only, `page` stays valid
+    page_t* page = proc_get_page(state->directory, virt, true, flags);
+
+    // Pages shared by two segments get the permissions of both
+    if (*page & PAGE_PRESENT) {
+        *page |= flags;
+
+        if (!(state->reuse && *page & PAGE_SHARED)) {
+            elf_fill_page(data, phdr, virt, *page & PAGE_FRAME);
+        }
+    } else if (!state->cache || !elf_page_shareable(data, virt)) {
+        uintptr_t phys = elf_new_frame();
+
+        elf_fill_page(data, phdr, virt, phys);
+        *page = phys | PAGE_PRESENT | flags;
+        state->image->num_pages++;
+    } else {
+        uintptr_t* frame = &state->cache->frames[state->next_shared++];
+
+        if (!state->reuse) {
+            *frame = elf_new_frame();
+            elf_fill_page(data, phdr, virt, *frame);
+        }
+
+        *page = *frame | PAGE_PRESENT | flags | PAGE_SHARED;
+    }
+
+    preempt_enable();
+}
+
+/* Maps the PT_LOAD segments of `data`, previously checked with `elf_check`,
+ * in the address space whose page directory is at `directory`, which mustn't
+ * be in use yet. Pages are writable only if their segment is, and are never
+ * executable, as i386 paging can't express that.
+ * Read-only pages are loaded once per executable, and shared by all processes
+ * running it afterwards: they're kept for as long as the kernel runs, as is
+ * `data`, the key to find them again. Callers must thus pass the same buffer
+ * for every instance of a program, see `kernel_module_data`. Writable pages are private copies, as
+ * are read-only pages when another process is loading them at the same time.
+ */
+void elf_load(uint8_t* data, uintptr_t directory, elf_image_t* image) {
+    elf_header_t* header = (elf_header_t*) data;
+    elf_phdr_t* phdrs = elf_phdrs(data);
+    elf_load_state_t state = {.image = image, .directory = directory};
+
+    *image = (elf_image_t) {.entry = header->entry};
+
+    preempt_disable();
+    spin_lock(&elf_cache_lock);
+
+    elf_cache_t* cache = elf_cache;
+
+    while (cache && cache->data != data) {
+        cache = cache->next;
+    }
+
+    if (!cache) {
+        uint32_t num_frames = 0;
+        elf_for_each_page(data, elf_count_page, &num_frames);
+
+        cache = kmalloc(sizeof(elf_cache_t) + num_frames * sizeof(uintptr_t));
+        cache->data = data;
+        cache->ready = false;
+        cache->next = elf_cache;
+        elf_cache = cache;
+        state.cache = cache;
+    } else if (__atomic_load_n(&cache->ready, __ATOMIC_ACQUIRE)) {
+        state.cache = cache;
+        state.reuse = true;
+    }
+
+    spin_unlock(&elf_cache_lock);
+    preempt_enable();
+
+    elf_for_each_page(data, elf_load_page, &state);
+
+    // The frames are filled, other loads may map them
+    if (state.cache && !state.reuse) {
+        __atomic_store_n(&state.cache->ready, true, __ATOMIC_RELEASE);
+    }
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        elf_phdr_t* phdr = &phdrs[i];
+
+        if (phdr->type == ELF_PT_LOAD && phdr->memsz && elf_has_zero_pages(phdr)) {
+            uint32_t page_flags = PAGE_USER | (phdr->flags & ELF_PF_W ? PAGE_RW : 0);
+
+            image->zero_regions[image->num_zero_regions++] = (proc_region_t) {
+                .start = align_to(phdr->vaddr + phdr->filesz, 0x1000),
+                .end = phdr->vaddr + phdr->memsz,
+                .flags = page_flags};
+        }
+    }
+}
@@ -0,0 +1,186 @@
+#include "kernel/sys/futex.h"
+
+#include "kernel/cpu/cpu.h"
+#include "kernel/cpu/clocksource.h"
+#include "kernel/mem/paging.h"
+#include "kernel/sys/hrtimer.h"
+#include "kernel/sys/proc.h"
+#include "kernel/sys/spinlock.h"
+#include "libc/syscall.h"
+
+/* Wait queues for userspace locks, which only enter the kernel when they're
+ * contended. A thread waits on a word of user memory, looked up by its
+ * physical address so that processes sharing the page find the same waiters.
+ * Waiters are hashed into buckets, each with its own lock, taken before the
+ * run queue and timer locks.
+ */
+
+typedef struct _futex_waiter_t {
+    struct _futex_waiter_t* next;
+    uintptr_t phys;
+    thread_t* thread;
+    bool woken;     // Set by `futex_do_wake`, under the bucket's lock
+    bool timed_out; // Set by `futex_timeout`, under the bucket's lock
+} futex_waiter_t;
+
+typedef struct {
+    spinlock_t lock;
+    futex_waiter_t* waiters; // In the order they started waiting
+} futex_bucket_t;
+
+// Zeroed locks are unlocked, see `SPINLOCK_INIT`
+static futex_bucket_t buckets[FUTEX_BUCKETS];
+
+static futex_bucket_t* futex_bucket(uintptr_t phys) {
+    // Fibonacci hashing, words of the same page land in different buckets
+    return &buckets[((phys >> 2) * 0x9E3779B1) >> (32 - FUTEX_HASH_BITS)];
+}
+
+/* Returns the physical address of the user word at `addr`, or 0 if it isn't
+ * mapped. Demand-zero pages are mapped first if `fault` is set.
+ */
+static uintptr_t futex_phys(uintptr_t addr, bool fault) {
+    page_t* page = paging_get_page(addr & PAGE_FRAME, false, 0);
+
+    if (!page || !(*page & PAGE_PRESENT)) {
+        if (!fault || !proc_fault(addr)) {
+            return 0;
+        }
+    }
+
+    return paging_virt_to_phys(addr);
+}
+
+static void futex_unlink(futex_bucket_t* bucket, futex_waiter_t* waiter) {
+    futex_waiter_t** link = &bucket->waiters;
+
+    while (*link != waiter) {
+        link = &(*link)->next;
+    }
+
+    *link = waiter->next;
+}
+
+/* Ends the wait of `timer->data` as `futex_do_wake` would, unless it was woken
+ * up first. The waiter's stack frame lives until `futex_do_wait` is done
+ * waiting for us, see `hrtimer_del_sync`.
+ */
+static void futex_timeout(hrtimer_t* timer) {
+    futex_waiter_t* waiter = timer->data;
+    futex_bucket_t* bucket = futex_bucket(waiter->phys);
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+
+    if (!waiter->woken) {
+        futex_unlink(bucket, waiter);
+        waiter->timed_out = true;
+        proc_unblock(waiter->thread);
+    }
+
+    spin_unlock_irqrestore(&bucket->lock, flags);
+}
+
+/* Blocks the current thread as long as the user word at `addr` holds `val`,
+ * until `futex_do_wake` is called on it, or `ns` nanoseconds have passed if
+ * `timed` is set. The check and the blocking are atomic with respect to
+ * `futex_do_wake`. Returns 0 once woken up, or one of the `FUTEX_*` errors.
+ * Implements the `futex_wait` system call.
+ */
+int32_t futex_do_wait(uintptr_t addr, uint32_t val, bool timed, uint64_t ns) {
+    uintptr_t phys = futex_phys(addr, true);
+
+    if (!phys) {
+        return FUTEX_INVALID;
+    }
+
+    thread_t* thread = current_thread;
+    futex_bucket_t* bucket = futex_bucket(phys);
+    futex_waiter_t waiter = {.phys = phys, .thread = thread};
+    hrtimer_t* timer = &thread->sleep_timer;
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+
+    // The page stays mapped as long as the process lives, this can't fault
+    if (*(volatile uint32_t*) addr != val) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return FUTEX_AGAIN;
+    }
+
+    if (timed && !ns) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return FUTEX_TIMEDOUT;
+    }
+
+    futex_waiter_t** link = &bucket->waiters;
+
+    while (*link) {
+        link = &(*link)->next;
+    }
+
+    *link = &waiter;
+
+    // Its callback takes the bucket's lock, it can't end the wait before we
+    // block or see `timed_out`
+    if (timed) {
+        timer->expires = clock_monotonic_ns() + ns;
+        timer->callback = futex_timeout;
+        timer->data = &waiter;
+        hrtimer_add(timer);
+    }
+
+    while (!waiter.woken && !waiter.timed_out) {
+        // Woken up to exit, see `proc_exit_process`. Marked as woken up so
+        // that the timer leaves the waiter alone.
+        if (thread->process->exiting) {
+            futex_unlink(bucket, &waiter);
+            waiter.woken = true;
+            break;
+        }
+
+        proc_block_on(&bucket->lock);
+        spin_lock(&bucket->lock);
+    }
+
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    if (timed) {
+        hrtimer_del_sync(timer);
+    }
+
+    return waiter.timed_out ? FUTEX_TIMEDOUT : 0;
+}
+
+/* Wakes up to `num` threads waiting on the user word at `addr`, oldest first.
+ * Returns how many were woken up. Implements the `futex_wake` system call.
+ */
+int32_t futex_do_wake(uintptr_t addr, uint32_t num) {
+    // Nobody can wait on a page that was never touched
+    uintptr_t phys = futex_phys(addr, false);
+
+    if (!phys) {
+        return 0;
+    }
+
+    futex_bucket_t* bucket = futex_bucket(phys);
+    futex_waiter_t** link = &bucket->waiters;
+    uint32_t woken = 0;
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+
+    while (*link && woken < num) {
+        futex_waiter_t* waiter = *link;
+
+        if (waiter->phys != phys) {
+            link = &waiter->next;
+            continue;
+        }
+
+        // The waiter's stack frame lives until it sees `woken`, which takes
+        // the lock we hold
+        *link = waiter->next;
+        waiter->woken = true;
+        proc_unblock(waiter->thread);
+        woken++;
+    }
+
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    return woken;
+}
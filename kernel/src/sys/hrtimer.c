@@ -0,0 +1,226 @@
+#include "kernel/sys/hrtimer.h"
+
+#include "kernel/cpu/cpu.h"
+#include "kernel/cpu/timer.h"
+#include "kernel/sys/spinlock.h"
+
+/* High resolution timers are kept in a pairing heap, ordered by expiry, which
+ * needs no memory besides the timers themselves. Adding a timer is O(1),
+ * removing one is O(log n) amortized. Each timer links to its first child, to
+ * its next sibling, and to its previous sibling, or to its parent if it's the
+ * first child.
+ */
+
+static hrtimer_t* heap;
+
+// Protects the heap, timers may be added from any CPU. Taken after the run
+// queue and timer locks.
+static spinlock_t hrtimer_lock = SPINLOCK_INIT;
+
+// Timer whose callback each CPU is running, see `hrtimer_del_sync`. Callbacks
+// run with preemption disabled, so a CPU's slot is only written by that CPU.
+static hrtimer_t* volatile running[CPU_MAX];
+
+/* Merges two detached heaps, and returns the root of the result. */
+static hrtimer_t* hrtimer_meld(hrtimer_t* a, hrtimer_t* b) {
+    if (!a || !b) {
+        return a ? a : b;
+    }
+
+    if (b->expires < a->expires) {
+        hrtimer_t* tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    // `b` becomes the first child of `a`
+    b->prev = a;
+    b->next = a->child;
+
+    if (a->child) {
+        a->child->prev = b;
+    }
+
+    a->child = b;
+
+    return a;
+}
+
+/* Merges a list of siblings into a single heap: pairs of them from left to
+ * right, then the results from right to left, which is what keeps the heap
+ * shallow.
+ */
+static hrtimer_t* hrtimer_merge_pairs(hrtimer_t* first) {
+    hrtimer_t* pairs = NULL;
+
+    while (first) {
+        hrtimer_t* a = first;
+        hrtimer_t* b = a->next;
+
+        first = b ? b->next : NULL;
+        a->next = a->prev = NULL;
+
+        if (b) {
+            b->next = b->prev = NULL;
+        }
+
+        // Pairs are chained in reverse order
+        hrtimer_t* pair = hrtimer_meld(a, b);
+        pair->next = pairs;
+        pairs = pair;
+    }
+
+    hrtimer_t* root = NULL;
+
+    while (pairs) {
+        hrtimer_t* next = pairs->next;
+
+        pairs->next = NULL;
+        root = hrtimer_meld(root, pairs);
+        pairs = next;
+    }
+
+    return root;
+}
+
+static void hrtimer_link(hrtimer_t* timer) {
+    timer->child = timer->next = timer->prev = NULL;
+    timer->pending = true;
+    heap = hrtimer_meld(heap, timer);
+}
+
+static void hrtimer_unlink(hrtimer_t* timer) {
+    if (timer == heap) {
+        heap = hrtimer_merge_pairs(timer->child);
+    } else {
+        // Cut the subtree of `timer` out, then merge its children back in
+        if (timer->prev->child == timer) {
+            timer->prev->child = timer->next;
+        } else {
+            timer->prev->next = timer->next;
+        }
+
+        if (timer->next) {
+            timer->next->prev = timer->prev;
+        }
+
+        heap = hrtimer_meld(heap, hrtimer_merge_pairs(timer->child));
+    }
+
+    timer->child = timer->next = timer->prev = NULL;
+    timer->pending = false;
+}
+
+/* Arms `timer` to have its callback called once the monotonic clock reaches
+ * `timer->expires`. The callback is run from the timer softirq, with
+ * interrupts enabled. The timer interrupt is reprogrammed if the timer is the
+ * first one to expire.
+ */
+void hrtimer_add(hrtimer_t* timer) {
+    hrtimer_mod(timer, timer->expires);
+}
+
+/* Same as `hrtimer_add`, for `expires`. Returns whether the timer was pending.
+ */
+bool hrtimer_mod(hrtimer_t* timer, uint64_t expires) {
+    uint32_t flags = spin_lock_irqsave(&hrtimer_lock);
+    bool pending = timer->pending;
+
+    if (pending) {
+        hrtimer_unlink(timer);
+    }
+
+    timer->expires = expires;
+    hrtimer_link(timer);
+
+    bool first = heap == timer;
+    spin_unlock_irqrestore(&hrtimer_lock, flags);
+
+    if (first) {
+        timer_update();
+    }
+
+    return pending;
+}
+
+/* Disarms `timer`, and returns whether it was pending. An early timer
+ * interrupt may follow, which is harmless.
+ */
+bool hrtimer_del(hrtimer_t* timer) {
+    uint32_t flags = spin_lock_irqsave(&hrtimer_lock);
+    bool pending = timer->pending;
+
+    if (pending) {
+        hrtimer_unlink(timer);
+    }
+
+    spin_unlock_irqrestore(&hrtimer_lock, flags);
+
+    return pending;
+}
+
+/* Same as `hrtimer_del`, but also waits for the callback of `timer` to return
+ * if another CPU is running it. The timer's memory, and whatever its callback
+ * uses, may be reused afterwards. Must not be called from the callback, nor
+ * with a lock it takes held.
+ */
+bool hrtimer_del_sync(hrtimer_t* timer) {
+    bool pending = hrtimer_del(timer);
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        while (running[i] == timer) {
+            asm volatile("pause");
+        }
+    }
+
+    return pending;
+}
+
+bool hrtimer_pending(hrtimer_t* timer) {
+    return timer->pending;
+}
+
+/* Runs the callbacks of the timers expired at `now`, at most `budget` of
+ * them, earliest first. Returns whether some are left.
+ */
+bool hrtimer_run(uint64_t now, uint32_t budget) {
+    uint32_t flags = spin_lock_irqsave(&hrtimer_lock);
+
+    while (heap && heap->expires <= now) {
+        if (!budget--) {
+            spin_unlock_irqrestore(&hrtimer_lock, flags);
+            return true;
+        }
+
+        hrtimer_t* timer = heap;
+        uint32_t id = cpu_current()->id;
+
+        hrtimer_unlink(timer);
+        running[id] = timer;
+
+        // Callbacks usually add timers, they run without the lock
+        spin_unlock_irqrestore(&hrtimer_lock, flags);
+        timer->callback(timer);
+        flags = spin_lock_irqsave(&hrtimer_lock);
+
+        running[id] = NULL;
+    }
+
+    spin_unlock_irqrestore(&hrtimer_lock, flags);
+
+    return false;
+}
+
+/* Finds when the next timer expires, returns false if none is pending. */
+bool hrtimer_next_expiry(uint64_t* expires) {
+    uint32_t flags = spin_lock_irqsave(&hrtimer_lock);
+    bool found = heap != NULL;
+
+    if (found) {
+        *expires = heap->expires;
+    }
+
+    spin_unlock_irqrestore(&hrtimer_lock, flags);
+
+    return found;
+}
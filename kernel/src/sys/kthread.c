@@ -0,0 +1,25 @@
+#include "kernel/sys/kthread.h"
+
+#include "kernel/kernel.h"
+
+/* First code run by kernel threads, with interrupts enabled: they're
+ * preempted as any other thread. The thread exits when its function returns.
+ */
+static void kthread_entry() {
+    current_thread->kthread_func(current_thread->kthread_arg);
+    proc_exit(0);
+}
+
+/* Creates a kernel thread running `func(arg)`, and makes it runnable. Kernel
+ * threads run in ring 0 as part of the kernel process, and are scheduled
+ * like any other thread.
+ */
+thread_t* kthread_create(void (*func)(void*), void* arg) {
+    thread_t* thread = proc_create_kernel_task(kthread_entry);
+
+    thread->kthread_func = func;
+    thread->kthread_arg = arg;
+    proc_add(thread);
+
+    return thread;
+}
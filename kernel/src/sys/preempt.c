@@ -0,0 +1,68 @@
+#include "kernel/sys/preempt.h"
+
+#include "kernel/cpu/cpu.h"
+#include "kernel/sys/proc.h"
+#include "kernel/sys/softirq.h"
+#include "kernel/sys/spinlock.h"
+
+/* The kernel may be preempted whenever interrupts are enabled, unless the
+ * preemption counter of the executing CPU is positive. Interrupt handlers
+ * never switch threads themselves: they set `need_resched`, and the switch
+ * happens on their way out of the outermost one, see `preempt_check_resched`,
+ * or once the counter drops back to zero.
+ * The counter is only touched by single %fs-relative instructions, which an
+ * interrupt can't split: a thread can't be migrated between finding its CPU
+ * and updating that CPU's counter.
+ */
+
+#define PREEMPT_COUNT_OFFSET __builtin_offsetof(cpu_t, preempt_count)
+
+/* Keeps the current thread on this CPU until the matching `preempt_enable`.
+ * Regions may nest, and must not block.
+ */
+void preempt_disable() {
+    asm volatile("incl %%fs:%c0" ::"i"(PREEMPT_COUNT_OFFSET) : "memory");
+}
+
+/* Ends a region started by `preempt_disable`, and lets softirqs raised and
+ * preemption requested in the meantime happen.
+ */
+void preempt_enable() {
+    asm volatile("decl %%fs:%c0" ::"i"(PREEMPT_COUNT_OFFSET) : "memory");
+
+    if (irq_enabled()) {
+        softirq_run();
+        preempt_check_resched();
+    }
+}
+
+uint32_t preempt_count() {
+    uint32_t count;
+
+    asm volatile("mov %%fs:%c1, %0" : "=r"(count) : "i"(PREEMPT_COUNT_OFFSET));
+
+    return count;
+}
+
+/* Asks for the current thread to be preempted as soon as possible. Called by
+ * interrupt handlers, which the thread can't be migrated from.
+ */
+void preempt_set_need_resched() {
+    cpu_current()->need_resched = true;
+}
+
+/* Runs the scheduler if preemption was requested and is allowed. Called when
+ * returning from interrupts and system calls, and when preemption is enabled
+ * again. Nested interrupt handlers leave it to the outermost one: the handlers
+ * they interrupted must finish, and restore the interrupt priority, first.
+ */
+void preempt_check_resched() {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = cpu_current();
+
+    if (cpu->need_resched && !cpu->preempt_count && !cpu->irq_depth) {
+        proc_schedule();
+    }
+
+    irq_restore(flags);
+}
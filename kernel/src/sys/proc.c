@@ -1,15 +1,27 @@
 #include "kernel/sys/proc.h"
 
+#include "kernel/boot/cmdline.h"
+#include "kernel/cpu/clocksource.h"
+#include "kernel/cpu/cpuid.h"
 #include "kernel/cpu/fpu.h"
 #include "kernel/cpu/gdt.h"
+#include "kernel/cpu/smp.h"
 #include "kernel/cpu/timer.h"
 #include "kernel/cpu/tss.h"
 #include "kernel/kernel.h"
 #include "kernel/lib/kprintf.h"
+#include "kernel/mem/arena.h"
 #include "kernel/mem/malloc.h"
 #include "kernel/mem/paging.h"
 #include "kernel/mem/pmm.h"
+#include "kernel/sys/elf.h"
+#include "kernel/sys/preempt.h"
+#include "kernel/sys/ring.h"
+#include "kernel/sys/sched_mlfq.h"
 #include "kernel/sys/sched_robin.h"
+#include "kernel/sys/softirq.h"
+#include "kernel/sys/syscall_stats.h"
+#include "kernel/sys/workqueue.h"
 #include "kernel/utils/debug.h"
 #include "libc/math.h"
 #include "libc/stdio.h"
@@ -18,259 +30,1343 @@
 
 extern uint32_t irq_handler_end;
 
-process_t* current_process = NULL;
-sched_t* scheduler = NULL;
+// Defined in proc.asm
+extern void proc_user_start();
 
 static uint32_t next_pid = 1;
 
+/* Owns the kernel threads, which all run in the kernel's address space. It's
+ * never freed, and its threads are never joined.
+ */
+static process_t kernel_process;
+
+/* Each CPU has an idle thread, which runs whenever its run queue is empty and
+ * there's nothing to steal from the others. It's never part of a scheduler's
+ * pool, and runs in kernel mode on its own stack.
+ */
+static bool idle_mwait = false;
+
+// Two pages per CPU whose mapping we change at will, see `proc_map_temp`
+static uintptr_t temp_pages = 0;
+
+// User processes, newest first. The lock is never taken from interrupts.
+static process_t* processes = NULL;
+static spinlock_t processes_lock = SPINLOCK_INIT;
+
+static void proc_idle();
+void proc_reschedule_handler(REGISTERS* regs);
+static bool proc_sched_softirq(uint32_t budget);
+
+/* Sets up a run queue per CPU, using the scheduler chosen with `sched=` on the
+ * kernel command line, round robin by default. CPUs must have been counted
+ * already, see `init_smp`.
+ */
 void init_proc() {
-    scheduler = sched_robin();
+    const char* sched_name = cmdline_get("sched");
+    bool mlfq = sched_name && !strcmp(sched_name, "mlfq");
+
+    if (mlfq) {
+        kprintf_info("using the multi-level feedback queue scheduler");
+    }
+
+    temp_pages = (uintptr_t) kamalloc(0x2000 * cpu_count, 0x1000);
+    idle_mwait = cpuid(1, 0).ecx & CPUID_ECX_MONITOR;
+
+    kernel_process = (process_t) {.pid = 0, .directory = paging_get_kernel_directory(), .lock = SPINLOCK_INIT};
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+
+        cpu->scheduler = mlfq ? sched_mlfq() : sched_robin();
+        cpu->idle_thread = proc_create_kernel_task(proc_idle);
+        cpu->idle_thread->cpu = cpu;
+    }
+
+    isr_register_handler(SMP_IPI_RESCHEDULE, proc_reschedule_handler);
+    softirq_register(SOFTIRQ_SCHED, proc_sched_softirq, 1);
 }
 
-/* Creates a process running the code specified at `code` in raw instructions
- * and add it to the process queue, after the currently executing process.
- * `argv` is the array of arguments, NULL terminated.
+/* Maps the physical page `phys` at the temporary page number `slot` of this
+ * CPU, which is 0 or 1, and returns its address. Preemption must be disabled
+ * for as long as the mapping is used.
  */
-process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
-    static uintptr_t temp_page = 0;
+void* proc_map_temp(uint32_t slot, uintptr_t phys) {
+    uintptr_t virt = temp_pages + (cpu_current()->id * 2 + slot) * 0x1000;
+    page_t* p = paging_get_page(virt, false, 0);
+
+    *p = phys | PAGE_PRESENT | PAGE_RW;
+    paging_invalidate_page(virt);
+
+    return (void*) virt;
+}
+
+/* Allocates a thread of `process` with its own kernel stack, for the caller
+ * to lay out. Kernel threads aren't linked to their process, no one ever
+ * looks for them.
+ */
+static thread_t* proc_new_thread(process_t* process) {
+    thread_t* thread = kmalloc(sizeof(thread_t));
+    uintptr_t kernel_stack = (uintptr_t) aligned_alloc(4, 0x1000 * PROC_KERNEL_STACK_PAGES);
 
-    if (!temp_page) {
-        temp_page = (uintptr_t) kamalloc(0x1000, 0x1000);
+    *thread = (thread_t) {.process = process,
+        .directory = process->directory,
+        .kernel_stack = kernel_stack + PROC_KERNEL_STACK_PAGES * 0x1000 - 4,
+        .state = PROC_STATE_RUNNING};
+
+    uint32_t flags = spin_lock_irqsave(&process->lock);
+
+    thread->tid = ++process->next_tid;
+    process->num_threads++;
+
+    if (process != &kernel_process) {
+        thread->next = process->threads;
+        process->threads = thread;
     }
 
-    // Save arguments before switching directory and losing them
-    list_t args = LIST_HEAD_INIT(args);
+    spin_unlock_irqrestore(&process->lock, flags);
 
-    while (argv && *argv) {
-        char* buff = (char*) kmalloc((strlen(*argv) + 1) * sizeof(char));
+    return thread;
+}
+
+/* Allocates a thread of the kernel process running `entry` in kernel mode.
+ * `entry` must never return. The thread isn't added to the scheduler.
+ */
+thread_t* proc_create_kernel_task(void (*entry)()) {
+    thread_t* thread = proc_new_thread(&kernel_process);
 
-        list_add_front(&args, (void*) strcpy(buff, *argv));
-        argv++;
+    // Lay out the stack as `proc_init_user_stack` does, but for an `iret` to
+    // ring 0, which pops neither %esp nor %ss
+    uint32_t* stack = (uint32_t*) thread->kernel_stack;
+
+    *--stack = 0x202; // %eflags with `IF` bit set
+    *--stack = 0x08;  // kernel cs selector
+    *--stack = (uintptr_t) entry;
+    stack -= 2; // Error code, interrupt number
+    stack -= 8; // `pusha` equivalent
+
+    *--stack = 0x10;         // %ds
+    *--stack = 0x10;         // %es
+    *--stack = CPU_SELECTOR; // %fs, see `cpu_current`
+    *--stack = 0x10;         // %gs
+
+    *--stack = (uintptr_t) &irq_handler_end;
+    stack -= 4; // %ebx, %esi, %edi, %ebp
+
+    thread->saved_kernel_stack = (uintptr_t) stack;
+
+    return thread;
+}
+
+/* Lays out the kernel stack of `thread` as if it had been interrupted in
+ * userspace right before `eip`, with its stack pointer at `esp`. Switching to
+ * the thread then returns there from the interrupt.
+ */
+static void proc_init_user_stack(thread_t* thread, uintptr_t eip, uintptr_t esp) {
+    uint32_t* stack = (uint32_t*) thread->kernel_stack;
+
+    // Stuff popped by `iret`
+    *--stack = 0x23;  // user ds selector
+    *--stack = esp;
+    *--stack = 0x202; // %eflags with `IF` bit set
+    *--stack = 0x1B;  // user cs selector
+    *--stack = eip;
+    stack -= 2; // Error code, interrupt number
+    stack -= 8; // `pusha` equivalent
+
+    *--stack = 0x20;             // %ds
+    *--stack = 0x20;             // %es
+    *--stack = 0x20;             // %fs
+    *--stack = GDT_TLS_SELECTOR; // %gs
+
+    // `proc_switch_process`'s `ret` %eip
+    *--stack = (uintptr_t) proc_user_start;
+    stack -= 4; // %ebx, %esi, %edi, %ebp
+
+    thread->saved_kernel_stack = (uintptr_t) stack;
+}
+
+/* Waits for an interrupt. With MWAIT, the CPU may enter a deeper sleep state
+ * than with HLT. In both cases, `sti` delays interrupts by one instruction, so
+ * none can slip in before the wait and leave us asleep with work to do.
+ */
+static void proc_idle_wait() {
+    if (idle_mwait) {
+        asm volatile("monitor\n" ::"a"(&cpu_current()->idle_ns), "c"(0), "d"(0));
+        asm volatile("sti\n"
+                     "mwait\n" ::"a"(0), "c"(0));
+    } else {
+        asm volatile("sti\n"
+                     "hlt\n");
     }
+}
 
-    // TODO: this assumes .bss sections are marked as progbits
-    uint32_t num_code_pages = divide_up(size, 0x1000);
-    uint32_t num_stack_pages = PROC_STACK_PAGES;
+/* The idle thread: checks for runnable threads after every interrupt.
+ */
+static void proc_idle() {
+    while (true) {
+        disable_interrupts();
+        proc_schedule();
+        proc_idle_wait();
+    }
+}
 
-    process_t* process = kmalloc(sizeof(process_t));
-    uintptr_t kernel_stack = (uintptr_t) aligned_alloc(4, 0x1000 * PROC_KERNEL_STACK_PAGES);
-    uintptr_t pd_phys = pmm_alloc_page();
+/* Returns the time spent idling since boot by all CPUs, in nanoseconds.
+ */
+uint64_t proc_idle_ns() {
+    uint64_t now = clock_monotonic_ns();
+    uint64_t total = 0;
 
-    // Copy the kernel page directory with a temporary mapping
-    page_t* p = paging_get_page(temp_page, false, 0);
-    *p = pd_phys | PAGE_PRESENT | PAGE_RW;
-    memcpy((void*) temp_page, (void*) 0xFFFFF000, 0x1000);
-    directory_entry_t* pd = (directory_entry_t*) temp_page;
-    pd[1023] = pd_phys | PAGE_PRESENT | PAGE_RW;
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+        total += cpu->idle_ns;
 
-    // ">> 22" grabs the address's index in the page directory, see `paging.c`
-    for (uint32_t i = 0; i < (KERNEL_BASE_VIRT >> 22); i++) {
-        pd[i] = 0; // Unmap everything below the kernel
+        if (cpu->current == cpu->idle_thread) {
+            total += now - cpu->idle_start;
+        }
     }
 
-    // We can now switch to that directory to modify it easily
-    uintptr_t previous_pd = *paging_get_page(0xFFFFF000, false, 0) & PAGE_FRAME;
-    paging_switch_directory(pd_phys);
+    return total;
+}
+
+/* Returns the page table entry of `virt` in the address space whose page
+ * directory is at `directory`, as `paging_get_page` does for the current one.
+ * The entry is reached through temporary mapping 1, and stays valid until
+ * it's reused: preemption must be disabled for as long as it's used.
+ */
+page_t* proc_get_page(uintptr_t directory, uintptr_t virt, bool create, uint32_t flags) {
+    directory_entry_t* pd = proc_map_temp(0, directory);
+    uint32_t index = virt >> 22;
 
-    // Map the code and copy it to physical pages, zero out the excess memory
-    // for static variables
-    // TODO: don't require contiguous pages
-    uintptr_t code_phys = pmm_alloc_pages(num_code_pages);
-    paging_map_pages(0x00001000, code_phys, num_code_pages, PAGE_USER | PAGE_RW);
-    memcpy((void*) 0x00001000, (void*) code, size);
-    memset((uint8_t*) 0x1000 + size, 0, num_code_pages * 0x1000 - size);
+    if (!(pd[index] & PAGE_PRESENT)) {
+        if (!create) {
+            return NULL;
+        }
 
-    // Map the stack
-    uintptr_t stack_phys = pmm_alloc_pages(num_stack_pages);
-    paging_map_pages(0xC0000000 - 0x1000 * num_stack_pages, stack_phys, num_stack_pages, PAGE_USER | PAGE_RW);
+        uintptr_t table = pmm_alloc_page();
+
+        pd[index] = table | PAGE_PRESENT | PAGE_RW | (flags & PAGE_FLAGS);
+        memset(proc_map_temp(1, table), 0, 0x1000);
+    }
+
+    page_t* table = proc_map_temp(1, pd[index] & PAGE_FRAME);
+
+    return &table[(virt >> 12) & 0x3FF];
+}
+
+/* Creates a process running the ELF executable of `size` bytes at `code` in
+ * a single thread, and makes it runnable. `argv` is the array of arguments,
+ * NULL terminated. Returns NULL if `code` isn't a valid executable, or if the
+ * arguments don't fit on the stack.
+ * The new address space is filled a page at a time through temporary
+ * mappings, preemption is only disabled for that long.
+ */
+process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
+    if (!elf_check(code, size)) {
+        return NULL;
+    }
+
+    uint32_t num_stack_pages = PROC_STACK_PAGES;
+    uint32_t stack_size = 0x1000 * num_stack_pages;
+    uintptr_t stack_base = KERNEL_BASE_VIRT - stack_size;
+    uint32_t arg_count = 0;
+    // argc, argv, and the slack of the alignments below
+    uint32_t args_size = 4 * sizeof(uint32_t);
+
+    // Each argument takes its bytes, its null byte, padding and a pointer
+    while (argv && argv[arg_count]) {
+        args_size += strlen(argv[arg_count++]) + 1 + 3 + sizeof(char*);
+    }
+
+    if (args_size > stack_size) {
+        kprintf_error("arguments don't fit on the stack");
+        return NULL;
+    }
+
+    // The stack is laid out in kernel memory, then copied to its frames.
+    // Everything here is temporary, so it all lives in a single arena, sized
+    // so that it never grows: the extra page holds its header and alignment.
+    uint32_t arena_size = stack_size + arg_count * sizeof(uintptr_t) + ARENA_ALIGN;
+    arena_t* arena = arena_create(divide_up(arena_size, 0x1000) + 1);
+    uintptr_t* user_args = arena_alloc(arena, arg_count * sizeof(uintptr_t));
+    uint8_t* stack = arena_alloc(arena, stack_size);
+
+    memset(stack, 0, stack_size);
 
     /* Setup the (argc, argv) part of the userstack, start by copying the given
      * arguments on that stack. */
-    list_t arglist = LIST_HEAD_INIT(arglist);
-    char* ustack_char = (char*) (0xC0000000 - 1);
+    char* ustack_char = (char*) stack + stack_size - 1;
 
-    char* arg;
-    list_for_each_entry(arg, &args) {
-        uint32_t len = strlen(arg);
+    for (uint32_t i = arg_count; i-- > 0;) {
+        uint32_t len = strlen(argv[i]);
 
-        // We need (ustack_char - len) to be 4-bytes aligned
+        // We need (ustack_char - len) to be 4-bytes aligned, as `stack` is
         ustack_char -= ((uintptr_t) ustack_char - len) % 4;
         char* dest = ustack_char - len;
 
-        strncpy(dest, arg, len);
+        memcpy(dest, argv[i], len);
         ustack_char -= len + 1; // Keep pointing to a free byte
 
-        list_add(&arglist, (void*) dest);
-        kfree(arg);
+        user_args[i] = stack_base + ((uint8_t*) dest - stack);
     }
 
     /* Write `argv` to the stack with the pointers created previously.
      * Note that we switch to an int pointer; we're writing addresses here. */
     uint32_t* ustack_int = (uint32_t*) ((uintptr_t) ustack_char & ~0x3);
-    uint32_t arg_count = 0;
 
-    list_for_each_entry(arg, &arglist) {
-        *(ustack_int--) = (uintptr_t) arg;
-        arg_count++;
+    for (uint32_t i = arg_count; i-- > 0;) {
+        *(ustack_int--) = user_args[i];
     }
 
     // Push program arguments
-    uintptr_t argsptr = (uintptr_t) (ustack_int + 1);
+    uintptr_t argsptr = stack_base + ((uint8_t*) (ustack_int + 1) - stack);
     *(ustack_int--) = arg_count ? argsptr : (uintptr_t) NULL;
     *(ustack_int--) = arg_count;
 
-    // Switch to the original page directory
-    paging_switch_directory(previous_pd);
+    uintptr_t esp = stack_base + ((uint8_t*) ustack_int - stack);
+
+    elf_image_t image;
+    process_t* process = kmalloc(sizeof(process_t));
+    uintptr_t pd_phys = pmm_alloc_page();
+
+    // Copy the kernel page directory with a temporary mapping
+    preempt_disable();
+
+    directory_entry_t* pd = proc_map_temp(0, pd_phys);
+    memcpy(pd, (void*) 0xFFFFF000, 0x1000);
+    pd[1023] = pd_phys | PAGE_PRESENT | PAGE_RW;
+
+    // ">> 22" grabs the address's index in the page directory, see `paging.c`
+    for (uint32_t i = 0; i < (KERNEL_BASE_VIRT >> 22); i++) {
+        pd[i] = 0; // Unmap everything below the kernel
+    }
+
+    preempt_enable();
+
+    // Map the code and data, sharing read-only pages with other instances of
+    // the program, .bss is mapped on demand
+    elf_load(code, pd_phys, &image);
+
+    // Map the stack
+    uintptr_t stack_phys = pmm_alloc_pages(num_stack_pages);
 
-    *process = (process_t) {.pid = next_pid++,
-        .code_len = num_code_pages,
+    for (uint32_t i = 0; i < num_stack_pages; i++) {
+        uintptr_t phys = stack_phys + i * 0x1000;
+
+        preempt_disable();
+        *proc_get_page(pd_phys, stack_base + i * 0x1000, true, PAGE_USER | PAGE_RW) =
+            phys | PAGE_PRESENT | PAGE_USER | PAGE_RW;
+        memcpy(proc_map_temp(0, phys), stack + i * 0x1000, 0x1000);
+        preempt_enable();
+    }
+
+    arena_destroy(arena);
+
+    *process = (process_t) {.pid = __atomic_fetch_add(&next_pid, 1, __ATOMIC_RELAXED),
+        .code_len = image.num_pages,
         .stack_len = num_stack_pages,
         .directory = pd_phys,
-        .kernel_stack = kernel_stack + PROC_KERNEL_STACK_PAGES * 0x1000 - 4,
-        .saved_kernel_stack = kernel_stack + PROC_KERNEL_STACK_PAGES * 0x1000 - 4,
-        .initial_user_stack = (uintptr_t) ustack_int,
-        .sleep_ticks = 0};
-
-    // We use this label as the return address from `proc_switch_process`
-    uint32_t* jmp = &irq_handler_end;
-
-    // Setup the process's kernel stack as if it had already been interrupted
-    asm volatile(
-        // Save our stack in %ebx
-        "mov %%esp, %%ebx\n"
-
-        // Temporarily use the new process's kernel stack
-        "mov %[kstack], %%eax\n"
-        "mov %%eax, %%esp\n"
-
-        // Stuff popped by `iret`
-        "push $0x23\n" // user ds selector
-        "mov %[ustack], %%eax\n"
-        "push %%eax\n"       // %esp
-        "push $0x202\n"      // %eflags with `IF` bit set
-        "push $0x1B\n"       // user cs selector
-        "push $0x00001000\n" // %eip
-        // Push error code, interrupt number
-        "sub $8, %%esp\n"
-        // `pusha` equivalent
-        "sub $32, %%esp\n"
-        // push data segment registers
-        "mov $0x20, %%eax\n"
-        "push %%eax\n"
-        "push %%eax\n"
-        "push %%eax\n"
-        "push %%eax\n"
-
-        // Push proc_switch_process's `ret` %eip
-        "mov %[jmp], %%eax\n"
-        "push %%eax\n"
-        // Push garbage %ebx, %esi, %edi, %ebp
-        "push $1\n"
-        "push $2\n"
-        "push $3\n"
-        "push $4\n"
-
-        // Save the new process's %esp in %eax
-        "mov %%esp, %%eax\n"
-        // Restore our stack
-        "mov %%ebx, %%esp\n"
-        // Update the new process's %esp
-        "mov %%eax, %[esp]\n"
-        : [esp] "=r"(process->saved_kernel_stack)
-        : [kstack] "r"(process->kernel_stack), [ustack] "r"(process->initial_user_stack), [jmp] "r"(jmp)
-        : "%eax", "%ebx");
-
-    scheduler->sched_add(scheduler, process);
+        .num_zero_regions = image.num_zero_regions,
+        .lock = SPINLOCK_INIT,
+        .resident_pages = image.num_pages + num_stack_pages};
+
+    memcpy(process->zero_regions, image.zero_regions, sizeof(image.zero_regions));
+
+    preempt_disable();
+    spin_lock(&processes_lock);
+    process->next = processes;
+    processes = process;
+    spin_unlock(&processes_lock);
+    preempt_enable();
+
+    thread_t* thread = proc_new_thread(process);
+
+    fpu_init_thread(thread);
+    proc_init_user_stack(thread, image.entry, esp);
+    proc_add(thread);
 
     return process;
 }
 
-/* Runs the scheduler. The scheduler may then decide to elect a new process, or
- * not.
+/* Locks the run queue `thread` belongs to. The thread may be stolen by
+ * another CPU until we hold the right lock, hence the loop.
  */
-void proc_schedule() {
-    process_t* next = scheduler->sched_next(scheduler);
+static cpu_t* proc_lock_rq(thread_t* thread, uint32_t* flags) {
+    while (true) {
+        cpu_t* cpu = thread->cpu;
+        *flags = spin_lock_irqsave(&cpu->rq_lock);
 
-    if (next == current_process) {
+        if (cpu == thread->cpu) {
+            return cpu;
+        }
+
+        spin_unlock_irqrestore(&cpu->rq_lock, *flags);
+    }
+}
+
+/* Lets other CPUs know that `cpu` got new work. If it's another CPU, it may
+ * have to preempt its thread. If it's us, an idle CPU may steal the work.
+ */
+static void proc_kick(cpu_t* cpu) {
+    cpu_t* self = cpu_current();
+
+    if (cpu != self) {
+        smp_send_reschedule(cpu);
         return;
     }
 
-    fpu_switch(current_process, next);
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t* other = &cpus[i];
+
+        if (other != self && other->online && other->current == other->idle_thread) {
+            smp_send_reschedule(other);
+            return;
+        }
+    }
+}
+
+/* Takes a runnable thread from the run queue of another CPU, for `cpu` which
+ * has nothing left to run. Run queue locks are never held two at a time, so
+ * CPUs stealing from each other can't deadlock.
+ */
+static thread_t* proc_steal(cpu_t* cpu) {
+    for (uint32_t i = 1; i < cpu_count; i++) {
+        cpu_t* victim = &cpus[(cpu->id + i) % cpu_count];
+        uint32_t flags = spin_lock_irqsave(&victim->rq_lock);
+        thread_t* thread = victim->scheduler->sched_steal(victim->scheduler);
+
+        if (thread) {
+            thread->cpu = cpu;
+        }
+
+        spin_unlock_irqrestore(&victim->rq_lock, flags);
+
+        if (thread) {
+            return thread;
+        }
+    }
+
+    return NULL;
+}
+
+/* Switches from the current thread to `next`, elected by `cpu`'s scheduler.
+ */
+static void proc_switch_to(cpu_t* cpu, thread_t* next) {
+    thread_t* prev = cpu->current;
+
+    if (next == prev) {
+        return;
+    }
+
+    uint64_t now = clock_monotonic_ns();
+
+    if (next == cpu->idle_thread) {
+        cpu->idle_start = now;
+    } else if (prev == cpu->idle_thread) {
+        cpu->idle_ns += now - cpu->idle_start;
+    }
+
+    // Threads still runnable were preempted, or yielded
+    prev->usage.run_ns += now - prev->run_start;
+    next->run_start = now;
+
+    if (prev->state == PROC_STATE_RUNNING) {
+        prev->usage.involuntary_switches++;
+    } else {
+        prev->usage.voluntary_switches++;
+    }
+
+    // %gs is reloaded from the GDT when returning to userspace
+    if (next->tls_base != prev->tls_base) {
+        gdt_set_tls(cpu->gdt, next->tls_base);
+    }
+
+    fpu_switch(prev, next);
     proc_switch_process(next);
 }
 
-/* Called on clock ticks, calls the scheduler.
+/* Asks for the timer callback to run within `ticks` ticks while `thread`
+ * executes, see `timer_set_deadline`. Threads whose ring is polled need a
+ * tick every so often, even when alone on their CPU.
+ */
+static void proc_set_deadline(thread_t* thread, uint32_t ticks) {
+    if (ring_polled(thread->process)) {
+        ticks = ticks ? min(ticks, RING_POLL_TICKS) : RING_POLL_TICKS;
+    }
+
+    timer_set_deadline(ticks);
+}
+
+/* Called by `proc_switch_process` once it left the stack and address space of
+ * `prev`: other CPUs may now run it, or free it if it exited.
+ */
+void proc_switch_finish(thread_t* prev) {
+    prev->on_cpu = false;
+}
+
+/* Runs the scheduler. The scheduler may then decide to elect a new thread, or
+ * not. A CPU with nothing left to run tries to steal work from the others.
+ * Interrupts stay disabled until we're back, so that the switch itself can't
+ * be preempted.
+ */
+void proc_schedule() {
+    uint32_t irq_flags = irq_save();
+    cpu_t* cpu = cpu_current();
+
+    if (cpu->preempt_count) {
+        kprintf_error("scheduling with preemption disabled");
+        abort();
+    }
+
+    cpu->need_resched = false;
+
+    uint32_t flags = spin_lock_irqsave(&cpu->rq_lock);
+    thread_t* next = cpu->scheduler->sched_next(cpu->scheduler);
+
+    if (!next) {
+        spin_unlock_irqrestore(&cpu->rq_lock, flags);
+        thread_t* stolen = proc_steal(cpu);
+        flags = spin_lock_irqsave(&cpu->rq_lock);
+
+        if (stolen) {
+            cpu->scheduler->sched_add(cpu->scheduler, stolen);
+            next = cpu->scheduler->sched_next(cpu->scheduler);
+        }
+    }
+
+    // Every thread is blocked: idle until an interrupt wakes one up, with no
+    // tick needed in the meantime
+    uint32_t ticks = 0;
+
+    if (next) {
+        next->on_cpu = true;
+        ticks = cpu->scheduler->sched_ticks_left(cpu->scheduler, next);
+    } else {
+        next = cpu->idle_thread;
+    }
+
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+
+    proc_set_deadline(next, ticks);
+    cpu->last_tick = timer_get_tick();
+
+    proc_switch_to(cpu, next);
+    irq_restore(irq_flags);
+}
+
+/* Charges the ticks elapsed since the last call to the current thread, and
+ * asks for it to be preempted if it's due, see `preempt.c`. With dynamic
+ * ticks, several ticks may have elapsed. Runs as the scheduler softirq, which
+ * is never left over: the budget is ignored.
+ */
+static bool proc_sched_softirq(uint32_t budget) {
+    unused(budget);
+
+    cpu_t* cpu = cpu_current();
+    uint32_t now = timer_get_tick();
+    uint32_t ticks = now - cpu->last_tick;
+
+    cpu->last_tick = now;
+
+    // The idle task checks for work by itself, there's no one to charge
+    if (!cpu->current || cpu->current == cpu->idle_thread) {
+        return false;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&cpu->rq_lock);
+    bool preempt = cpu->scheduler->sched_tick(cpu->scheduler, cpu->current, ticks);
+    uint32_t left = preempt ? 0 : cpu->scheduler->sched_ticks_left(cpu->scheduler, cpu->current);
+
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+
+    if (preempt) {
+        preempt_set_need_resched();
+    } else {
+        proc_set_deadline(cpu->current, left);
+    }
+
+    return false;
+}
+
+/* Called on clock ticks, leaves the scheduling to `proc_sched_softirq`.
+ * Where the tick found the current thread tells how to split its time between
+ * userspace and the kernel, see `proc_usage_split`. Threads interrupted in
+ * userspace get their ring polled on their way back, if they asked for it,
+ * see `proc_user_work`.
  */
 void proc_timer_callback(REGISTERS* regs) {
+    thread_t* thread = current_thread;
+
+    softirq_raise(SOFTIRQ_SCHED);
+
+    if (!thread) {
+        return;
+    }
+
+    if ((regs->cs & 3) != 3) {
+        thread->usage.system_ticks++;
+        return;
+    }
+
+    thread->usage.user_ticks++;
+
+    if (ring_polled(thread->process)) {
+        thread->ring_poll_due = true;
+    }
+}
+
+/* Another CPU gave us work, see `proc_kick`. The idle task looks for it by
+ * itself once the interrupt returns, a thread gets preempted only if the new
+ * work takes priority over it, which the scheduler softirq finds out.
+ */
+void proc_reschedule_handler(REGISTERS* regs) {
     unused(regs);
 
-    proc_schedule();
+    softirq_raise(SOFTIRQ_SCHED);
 }
 
-/* Make the first jump to usermode.
- * A special function is needed as our first kernel stack isn't setup to return
- * to any interrupt handler; we have to `iret` ourselves.
+/* Does what the current thread was left to do by interrupt handlers, before
+ * it goes back to userspace. Called on interrupt exit, with interrupts
+ * disabled, and may block.
+ */
+void proc_user_work() {
+    thread_t* thread = current_thread;
+    process_t* process = thread->process;
+
+    if (process->exiting) {
+        proc_exit(process->exit_status);
+    }
+
+    if (thread->ring_poll_due) {
+        thread->ring_poll_due = false;
+        ring_poll(thread->process);
+    }
+}
+
+/* Makes the first switch to a thread on this CPU.
+ * The boot code isn't a thread, so we switch away from a placeholder that's
+ * never resumed. The kernel stacks of new threads, be they in usermode or
+ * kernel threads, are set up to return from an interrupt, which does the rest.
  */
 void proc_enter_usermode() {
+    static thread_t boot_threads[CPU_MAX];
+
     disable_interrupts(); // Interrupts will be reenabled by `iret`
 
-    current_process = scheduler->sched_get_current(scheduler);
+    cpu_t* cpu = cpu_current();
+    uint32_t flags = spin_lock_irqsave(&cpu->rq_lock);
+    thread_t* next = cpu->scheduler->sched_get_current(cpu->scheduler);
+    uint32_t ticks = 0;
 
-    if (!current_process) {
-        kprintf_error("no process to run");
-        abort();
+    if (next) {
+        next->on_cpu = true;
+        ticks = cpu->scheduler->sched_ticks_left(cpu->scheduler, next);
+    } else {
+        next = cpu->idle_thread;
     }
 
-    timer_register_callback(&proc_timer_callback);
-    set_kernel_stack(current_process->kernel_stack);
-    paging_switch_directory(current_process->directory);
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+
+    if (cpu->id == 0) {
+        timer_register_callback(&proc_timer_callback);
+    }
 
-    asm volatile("mov $0x23, %%eax\n"
-                 "mov %%eax, %%ds\n"
-                 "mov %%eax, %%es\n"
-                 "mov %%eax, %%fs\n"
-                 "mov %%eax, %%gs\n"
-                 "push %%eax\n" // %ss
-                 "mov %[ustack], %%eax\n"
-                 "push %%eax\n"       // %esp
-                 "push $0x202\n"      // %eflags with IF set
-                 "push $0x1B\n"       // %cs
-                 "push $0x00001000\n" // %eip
-                 "iret\n" ::[ustack] "r"(current_process->initial_user_stack)
-        : "%eax");
+    cpu->last_tick = timer_get_tick();
+    proc_set_deadline(next, ticks);
+
+    cpu->current = &boot_threads[cpu->id];
+    proc_switch_to(cpu, next);
 }
 
-/* Terminates the currently executing process.
- * Implements the `exit` system call.
+/* Frees a process whose threads have all been reaped: its address space, its
+ * resources, and the threads no one joined.
  */
-void proc_exit() {
-    // Free allocated pages: code, heap, stack, page directory
-    directory_entry_t* pd = (directory_entry_t*) 0xFFFFF000;
+static void proc_free(process_t* process) {
+    preempt_disable();
+    spin_lock(&processes_lock);
+
+    process_t** link = &processes;
 
-    for (uint32_t i = 0; i < 768; i++) {
+    while (*link != process) {
+        link = &(*link)->next;
+    }
+
+    *link = process->next;
+    spin_unlock(&processes_lock);
+
+    directory_entry_t* pd = proc_map_temp(0, process->directory);
+
+    for (uint32_t i = 0; i < (KERNEL_BASE_VIRT >> 22); i++) {
         if (!(pd[i] & PAGE_PRESENT)) {
             continue;
         }
 
-        uintptr_t page = pd[i] & PAGE_FRAME;
-        pmm_free_page(page);
+        page_t* table = proc_map_temp(1, pd[i] & PAGE_FRAME);
+
+        for (uint32_t j = 0; j < 1024; j++) {
+            if (table[j] & PAGE_PRESENT && !(table[j] & PAGE_SHARED)) {
+                pmm_free_page(table[j] & PAGE_FRAME);
+            }
+        }
+
+        pmm_free_page(pd[i] & PAGE_FRAME);
     }
 
-    uintptr_t pd_page = pd[1023] & PAGE_FRAME;
-    pmm_free_page(pd_page);
+    pmm_free_page(process->directory);
+    preempt_enable();
 
-    // Free the kernel stack
-    kfree((void*) (current_process->kernel_stack - 0x1000 * PROC_KERNEL_STACK_PAGES + 4));
+    while (process->threads) {
+        thread_t* next = process->threads->next;
+
+        kfree(process->threads->syscall_stats);
+        kfree(process->threads);
+        process->threads = next;
+    }
+
+    kfree(process->ring);
+    kfree(process->syscall_stats);
+    kfree(process);
+}
+
+/* Frees the kernel stack of an exited thread, and its process if it was the
+ * last one. The thread itself is kept until it's joined, except for kernel
+ * threads. Runs from the system workqueue, as none of it can be freed while
+ * the thread is still executing.
+ */
+static void proc_reap(work_t* work) {
+    thread_t* thread = work->data;
+    process_t* process = thread->process;
+
+    // Its CPU may not be done switching away from it yet
+    while (thread->on_cpu) {
+        asm volatile("pause");
+    }
+
+    kfree((void*) (thread->kernel_stack - 0x1000 * PROC_KERNEL_STACK_PAGES + 4));
+
+    uint32_t flags = spin_lock_irqsave(&process->lock);
+    bool last = !--process->num_threads;
+
+    thread->state = PROC_STATE_DEAD;
+
+    if (thread->joiner) {
+        proc_unblock(thread->joiner);
+    }
+
+    spin_unlock_irqrestore(&process->lock, flags);
+
+    if (process == &kernel_process) {
+        kfree(thread);
+    } else if (last) {
+        proc_free(process);
+    }
+}
+
+/* Makes a new thread runnable, on the current CPU to begin with.
+ */
+void proc_add(thread_t* thread) {
+    // We may be preempted and migrated until interrupts are disabled
+    uint32_t flags = irq_save();
+    cpu_t* cpu = cpu_current();
+
+    spin_lock(&cpu->rq_lock);
+    thread->cpu = cpu;
+    cpu->scheduler->sched_add(cpu->scheduler, thread);
+    spin_unlock(&cpu->rq_lock);
+
+    proc_kick(cpu);
+    irq_restore(flags);
+}
+
+/* Terminates the currently executing thread, with `status` for whoever joins
+ * it. The process goes away along with its last thread. Implements the
+ * `thread_exit` system call: a thread exiting doesn't take the others with it.
+ */
+void proc_exit(uint32_t status) {
+    // Once queued for reaping, we must not be switched out before leaving the
+    // scheduler
+    disable_interrupts();
+
+    cpu_t* cpu = cpu_current();
+    thread_t* thread = cpu->current;
+    process_t* process = thread->process;
+
+    fpu_release(thread);
+    ring_thread_exit(thread);
+
+    // It may have been woken up early to exit, see `proc_exit_process`
+    hrtimer_del_sync(&thread->sleep_timer);
+
+    uint32_t flags = spin_lock_irqsave(&process->lock);
+
+    thread->exit_status = status;
+    thread->state = PROC_STATE_EXITED;
+    spin_unlock_irqrestore(&process->lock, flags);
+
+    // Freeing the kernel stack and the address space is deferred to keep
+    // exits cheap, and because we're still running on that kernel stack, in
+    // that address space
+    init_work(&thread->reap_work, proc_reap, thread);
+    queue_work(system_wq, &thread->reap_work);
+
+    flags = spin_lock_irqsave(&cpu->rq_lock);
+    cpu->scheduler->sched_exit(cpu->scheduler, thread);
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+
+    proc_schedule();
+}
+
+/* Terminates every thread of the current process, with `status` unless it's
+ * exiting already. The current thread exits right away, the others on their
+ * way back to userspace, see `proc_user_work`: blocked ones are woken up, and
+ * every other CPU is interrupted in case it runs one. Threads of an exiting
+ * process don't block anymore. Implements the `exit` system call.
+ */
+void proc_exit_process(uint32_t status) {
+    thread_t* self = current_thread;
+    process_t* process = self->process;
+    uint32_t flags = spin_lock_irqsave(&process->lock);
+
+    if (!process->exiting) {
+        process->exiting = true;
+        process->exit_status = status;
+    }
+
+    for (thread_t* thread = process->threads; thread; thread = thread->next) {
+        if (thread != self) {
+            proc_unblock(thread);
+        }
+    }
+
+    spin_unlock_irqrestore(&process->lock, flags);
+
+    // Interrupts stay disabled until we're gone, see `proc_exit`
+    disable_interrupts();
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+
+        if (cpu != cpu_current() && cpu->online) {
+            smp_send_reschedule(cpu);
+        }
+    }
+
+    proc_exit(process->exit_status);
+}
+
+/* Gives up the CPU in favor of the next thread the scheduler elects.
+ * Implements the `yield` system call.
+ */
+void proc_yield() {
+    proc_schedule();
+}
+
+/* Takes the current thread out of the scheduler until `proc_unblock` is
+ * called on it, and switches to another thread in the meantime.
+ */
+void proc_block() {
+    proc_block_on(NULL);
+}
+
+/* Same as `proc_block`, but also releases `lock`, which the caller holds with
+ * interrupts disabled, once the thread is marked as blocked. A wakeup issued
+ * after taking `lock` can't be missed: callers check their condition under
+ * `lock`, and block only if it's not met yet.
+ * Threads of an exiting process return right away, callers must check for it
+ * as they check their condition, see `proc_exit_process`.
+ */
+void proc_block_on(spinlock_t* lock) {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = cpu_current();
+    thread_t* thread = cpu->current;
+
+    spin_lock(&cpu->rq_lock);
+
+    // The flag is set before `proc_unblock` takes our run queue lock
+    if (thread->process->exiting) {
+        if (lock) {
+            spin_unlock(lock);
+        }
+
+        spin_unlock(&cpu->rq_lock);
+        irq_restore(flags);
+        return;
+    }
+
+    thread->state = PROC_STATE_BLOCKED;
+    cpu->scheduler->sched_block(cpu->scheduler, thread);
+
+    if (lock) {
+        spin_unlock(lock);
+    }
+
+    spin_unlock(&cpu->rq_lock);
+    proc_schedule();
+    irq_restore(flags);
+}
+
+/* Makes a blocked thread runnable again. Does nothing if it isn't blocked.
+ * The thread goes back to the run queue of the CPU it last ran on.
+ */
+void proc_unblock(thread_t* thread) {
+    uint32_t flags;
+    cpu_t* cpu = proc_lock_rq(thread, &flags);
+    cpu_t* self = cpu_current();
+
+    if (thread->state != PROC_STATE_BLOCKED) {
+        spin_unlock_irqrestore(&cpu->rq_lock, flags);
+        return;
+    }
+
+    thread->state = PROC_STATE_RUNNING;
+    cpu->scheduler->sched_unblock(cpu->scheduler, thread);
+
+    // The current thread may have to be preempted sooner now
+    bool busy = cpu->current && cpu->current != cpu->idle_thread;
+    uint32_t left = 0;
+
+    if (cpu == self && busy) {
+        left = cpu->scheduler->sched_ticks_left(cpu->scheduler, cpu->current);
+    }
+
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+
+    if (cpu != self) {
+        proc_kick(cpu);
+    } else if (busy) {
+        proc_set_deadline(cpu->current, left);
+        proc_kick(cpu);
+    }
+}
+
+static void proc_sleep_timeout(hrtimer_t* timer) {
+    proc_unblock((thread_t*) timer->data);
+}
+
+/* Blocks the current thread for at least `ns` nanoseconds. Sleeping threads
+ * wait on a high resolution timer, out of the scheduler's way.
+ */
+void proc_sleep(uint64_t ns) {
+    if (!ns) {
+        proc_yield();
+        return;
+    }
+
+    // Blocked but still running, we must not be preempted before switching
+    uint32_t flags = irq_save();
+    cpu_t* cpu = cpu_current();
+    thread_t* thread = cpu->current;
+    hrtimer_t* timer = &thread->sleep_timer;
+
+    timer->expires = clock_monotonic_ns() + ns;
+    timer->callback = proc_sleep_timeout;
+    timer->data = thread;
+
+    // The timer can't wake us up before we're marked as blocked, as that
+    // takes our run queue lock. Adding it reprograms the timer interrupt if
+    // needed.
+    spin_lock(&cpu->rq_lock);
+
+    // We'd be woken up to exit too late, see `proc_block_on`
+    if (thread->process->exiting) {
+        spin_unlock(&cpu->rq_lock);
+        irq_restore(flags);
+        return;
+    }
+
+    hrtimer_add(timer);
+    thread->state = PROC_STATE_BLOCKED;
+    cpu->scheduler->sched_block(cpu->scheduler, thread);
+
+    spin_unlock(&cpu->rq_lock);
 
-    // This last line is actually safe, and necessary
-    scheduler->sched_exit(scheduler, current_process);
     proc_schedule();
+    irq_restore(flags);
+}
+
+/* Adds `increment` to the niceness of the current thread, within bounds, and
+ * returns the new value. Schedulers read it when requeuing the thread.
+ * Implements the `nice` system call.
+ */
+int32_t proc_nice(int32_t increment) {
+    int32_t nice = current_thread->nice + increment;
+
+    current_thread->nice = max(PROC_NICE_MIN, min(nice, PROC_NICE_MAX));
+
+    return current_thread->nice;
+}
+
+static void proc_usage_add(proc_usage_t* total, proc_usage_t* usage) {
+    total->run_ns += usage->run_ns;
+    total->user_ticks += usage->user_ticks;
+    total->system_ticks += usage->system_ticks;
+    total->voluntary_switches += usage->voluntary_switches;
+    total->involuntary_switches += usage->involuntary_switches;
+    total->faults += usage->faults;
+}
+
+/* Reads the usage of `thread`, which the CPU running it may be updating: the
+ * run time is read again until it didn't change halfway through.
+ */
+static void proc_usage_read(thread_t* thread, proc_usage_t* usage) {
+    do {
+        *usage = thread->usage;
+    } while (usage->run_ns != *(volatile uint64_t*) &thread->usage.run_ns);
+}
+
+/* Sums up the usage of every thread `process` ever had. The time slices being
+ * run aren't included. Called with the process's lock held.
+ */
+static void proc_usage_sum(process_t* process, proc_usage_t* total) {
+    *total = process->joined_usage;
+
+    for (thread_t* thread = process->threads; thread; thread = thread->next) {
+        proc_usage_t usage;
+
+        proc_usage_read(thread, &usage);
+        proc_usage_add(total, &usage);
+    }
+}
+
+/* Splits the run time of `usage` between userspace and the kernel, in
+ * proportion to where timer interrupts found the threads. With dynamic ticks,
+ * threads running alone may take none, their time is then counted as user
+ * time.
+ */
+static void proc_usage_split(proc_usage_t* usage, uint64_t* user_ns, uint64_t* system_ns) {
+    uint32_t ticks = usage->user_ticks + usage->system_ticks;
+
+    if (!ticks) {
+        *user_ns = usage->run_ns;
+    } else {
+        // Split in two so that the product can't overflow
+        *user_ns = usage->run_ns / ticks * usage->user_ticks + usage->run_ns % ticks * usage->user_ticks / ticks;
+    }
+
+    *system_ns = usage->run_ns - *user_ns;
+}
+
+/* Fills `usage` with that of the current process, or of the current thread
+ * alone, depending on `who`. Returns 0, or -1 if `who` is invalid. Implements
+ * the `getrusage` system call.
+ */
+int32_t proc_getrusage(uint32_t who, rusage_t* usage) {
+    if (who != RUSAGE_SELF && who != RUSAGE_THREAD) {
+        return -1;
+    }
+
+    thread_t* self = current_thread;
+    process_t* process = self->process;
+    proc_usage_t total;
+    uint32_t flags = spin_lock_irqsave(&process->lock);
+
+    if (who == RUSAGE_SELF) {
+        proc_usage_sum(process, &total);
+    } else {
+        total = self->usage;
+    }
+
+    // We can't be switched out while the lock is held
+    total.run_ns += clock_monotonic_ns() - self->run_start;
+
+    uint32_t resident_pages = process->resident_pages;
+    spin_unlock_irqrestore(&process->lock, flags);
+
+    uint64_t user_ns, system_ns;
+    proc_usage_split(&total, &user_ns, &system_ns);
+
+    clock_ns_to_timespec(user_ns, &usage->ru_utime);
+    clock_ns_to_timespec(system_ns, &usage->ru_stime);
+    usage->ru_maxrss = resident_pages * 4;
+    usage->ru_minflt = total.faults;
+    usage->ru_nvcsw = total.voluntary_switches;
+    usage->ru_nivcsw = total.involuntary_switches;
+
+    return 0;
+}
+
+/* Prints a line per user process with its resource usage, see
+ * `proc_getrusage`.
+ */
+void proc_print_processes() {
+    kprintf("  PID THREADS  USER ms   SYS ms    VCSW   IVCSW  FAULTS  RSS KiB\n");
+
+    preempt_disable();
+    spin_lock(&processes_lock);
+
+    for (process_t* process = processes; process; process = process->next) {
+        proc_usage_t total;
+        uint32_t flags = spin_lock_irqsave(&process->lock);
+
+        proc_usage_sum(process, &total);
+
+        uint32_t num_threads = process->num_threads;
+        uint32_t resident_pages = process->resident_pages;
+        spin_unlock_irqrestore(&process->lock, flags);
+
+        uint64_t user_ns, system_ns;
+        proc_usage_split(&total, &user_ns, &system_ns);
+
+        kprintf("%5u %7u %8llu %8llu %7u %7u %7u %8u\n", process->pid, num_threads, user_ns / 1000000,
+            system_ns / 1000000, total.voluntary_switches, total.involuntary_switches, total.faults,
+            resident_pages * 4);
+    }
+
+    spin_unlock(&processes_lock);
+    preempt_enable();
 }
 
 uint32_t proc_get_current_pid() {
-    if (current_process) {
-        return current_process->pid;
+    thread_t* thread = current_thread;
+
+    if (thread) {
+        return thread->process->pid;
     } else {
         return 0;
     }
 }
+
+/* Maps a zeroed page at `addr` if it lies in one of the executing process's
+ * demand-zero regions, see `elf_load`. The page is zeroed before it's mapped,
+ * through a temporary mapping. Returns whether the fault was handled, which
+ * it also is when another thread mapped the page first.
+ * Pages are only ever added to the address space of a live process, so the
+ * TLBs of CPUs running its other threads never need to be flushed.
+ */
+bool proc_fault(uintptr_t addr) {
+    thread_t* thread = current_thread;
+
+    if (!thread) {
+        return false;
+    }
+
+    process_t* process = thread->process;
+    uintptr_t virt = addr & PAGE_FRAME;
+    bool handled = false;
+    uint32_t flags = spin_lock_irqsave(&process->lock);
+
+    for (uint32_t i = 0; i < process->num_zero_regions; i++) {
+        proc_region_t* region = &process->zero_regions[i];
+
+        if (addr < region->start || addr >= region->end) {
+            continue;
+        }
+
+        page_t* page = paging_get_page(virt, false, 0);
+
+        if (page && *page & PAGE_PRESENT) {
+            handled = true;
+            break;
+        }
+
+        if (page && *page & PAGE_GUARD) {
+            break;
+        }
+
+        uintptr_t phys = pmm_alloc_page();
+
+        if (phys) {
+            memset(proc_map_temp(0, phys), 0, 0x1000);
+            paging_map_page(virt, phys, region->flags);
+            process->resident_pages++;
+            thread->usage.faults++;
+            handled = true;
+        }
+
+        break;
+    }
+
+    spin_unlock_irqrestore(&process->lock, flags);
+
+    return handled;
+}
+
+/* Returns whether the kernel can access the `size` bytes of userspace at
+ * `addr` on behalf of the current process without faulting: they must lie in
+ * user pages, writable ones if `write` is set. Demand-zero pages in the range
+ * are mapped first, guard pages fail the check. Nothing is ever unmapped from
+ * a live process, so the range stays accessible afterwards.
+ */
+bool proc_check_user(uintptr_t addr, uint32_t size, bool write) {
+    uint32_t flags = PAGE_PRESENT | PAGE_USER | (write ? PAGE_RW : 0);
+
+    for (uintptr_t virt = addr & PAGE_FRAME; virt < addr + size; virt += 0x1000) {
+        page_t* page = paging_get_page(virt, false, 0);
+
+        if (!page || !(*page & PAGE_PRESENT)) {
+            if (!proc_fault(virt)) {
+                return false;
+            }
+
+            page = paging_get_page(virt, false, 0);
+        }
+
+        if ((*page & flags) != flags) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Makes the `num` pages at `addr` fault on any access instead of being mapped
+ * on demand, to catch stack overflows for instance. The pages must belong to a
+ * demand-zero region and never have been touched: as nothing gets unmapped,
+ * other CPUs running the process can't be left with stale TLB entries.
+ * Returns 0, or -1 if the range doesn't qualify. Implements the
+ * `guard_pages` system call.
+ */
+int32_t proc_guard(uintptr_t addr, uint32_t num) {
+    process_t* process = current_process;
+
+    if (addr % 0x1000 || !num || addr >= KERNEL_BASE_VIRT || num > (KERNEL_BASE_VIRT - addr) / 0x1000) {
+        return -1;
+    }
+
+    uintptr_t end = addr + num * 0x1000;
+    int32_t ret = -1;
+    uint32_t flags = spin_lock_irqsave(&process->lock);
+
+    for (uint32_t i = 0; i < process->num_zero_regions; i++) {
+        proc_region_t* region = &process->zero_regions[i];
+
+        if (addr < region->start || end > align_to(region->end, 0x1000)) {
+            continue;
+        }
+
+        ret = 0;
+
+        for (uintptr_t virt = addr; virt < end; virt += 0x1000) {
+            page_t* page = paging_get_page(virt, false, 0);
+
+            if (page && *page & PAGE_PRESENT) {
+                ret = -1;
+            }
+        }
+
+        for (uintptr_t virt = addr; virt < end && !ret; virt += 0x1000) {
+            *paging_get_page(virt, true, region->flags) = PAGE_GUARD;
+        }
+
+        break;
+    }
+
+    spin_unlock_irqrestore(&process->lock, flags);
+
+    return ret;
+}
+
+/* Starts a thread of the current process at `entry`, on the user stack whose
+ * top is at `stack`, as if `entry(arg)` had been called. Returns the id of the
+ * new thread, or -1 if the arguments are invalid, the stack not being writable
+ * user memory for instance. Threads must end with
+ * `thread_exit`, returning from `entry` faults. Implements the
+ * `thread_create` system call.
+ */
+int32_t proc_thread_create(uintptr_t entry, uintptr_t stack, uint32_t arg) {
+    thread_t* self = current_thread;
+    process_t* process = self->process;
+    uint32_t* ustack = (uint32_t*) (stack & ~0x3);
+
+    if (process == &kernel_process || entry >= KERNEL_BASE_VIRT || stack > KERNEL_BASE_VIRT ||
+        (uintptr_t) ustack < 0x1000 + 2 * sizeof(uint32_t)) {
+        return -1;
+    }
+
+    // The argument, then a null return address, written as system calls
+    // write their results
+    ustack -= 2;
+
+    if (!proc_check_user((uintptr_t) ustack, 2 * sizeof(uint32_t), true)) {
+        return -1;
+    }
+
+    ustack[1] = arg;
+    ustack[0] = 0;
+
+    thread_t* thread = proc_new_thread(process);
+
+    thread->nice = self->nice;
+    fpu_init_thread(thread);
+    proc_init_user_stack(thread, entry, (uintptr_t) ustack);
+    proc_add(thread);
+
+    return thread->tid;
+}
+
+/* Waits for thread `tid` of the current process to exit and be reaped, then
+ * frees it and stores its exit status at `status`, if not NULL. Returns 0, or
+ * -1 if there's no such thread, if it's the caller or if another thread is
+ * joining it already. Implements the `thread_join` system call.
+ */
+int32_t proc_thread_join(uint32_t tid, uint32_t* status) {
+    thread_t* self = current_thread;
+    process_t* process = self->process;
+    uint32_t flags = spin_lock_irqsave(&process->lock);
+    thread_t* thread = process->threads;
+
+    while (thread && thread->tid != tid) {
+        thread = thread->next;
+    }
+
+    if (!thread || thread == self || (thread->joiner && thread->joiner != self)) {
+        spin_unlock_irqrestore(&process->lock, flags);
+        return -1;
+    }
+
+    thread->joiner = self;
+
+    // Woken up by `proc_reap`, or to exit
+    while (thread->state != PROC_STATE_DEAD) {
+        if (process->exiting) {
+            thread->joiner = NULL;
+            spin_unlock_irqrestore(&process->lock, flags);
+            return -1;
+        }
+
+        proc_block_on(&process->lock);
+        spin_lock(&process->lock);
+    }
+
+    thread_t** link = &process->threads;
+
+    while (*link != thread) {
+        link = &(*link)->next;
+    }
+
+    *link = thread->next;
+    proc_usage_add(&process->joined_usage, &thread->usage);
+    syscall_proc_stat_t* stats = syscall_stats_join(thread);
+
+    // Userspace memory is only touched without the lock, see `proc_fault`
+    uint32_t exit_status = thread->exit_status;
+    spin_unlock_irqrestore(&process->lock, flags);
+
+    kfree(stats);
+    kfree(thread);
+
+    if (status) {
+        *status = exit_status;
+    }
+
+    return 0;
+}
+
+/* Points the TLS segment of the current thread, which userspace reaches
+ * through %gs, to `base`. Returns 0, or -1 if `base` isn't in userspace.
+ * Implements the `set_thread_area` system call.
+ */
+int32_t proc_set_tls(uintptr_t base) {
+    if (base >= KERNEL_BASE_VIRT) {
+        return -1;
+    }
+
+    // The GDT is that of the CPU we run on
+    uint32_t flags = irq_save();
+
+    current_thread->tls_base = base;
+    gdt_set_tls(cpu_current()->gdt, base);
+
+    irq_restore(flags);
+
+    return 0;
+}
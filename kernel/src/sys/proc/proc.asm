@@ -1,45 +1,66 @@
 section .text
 align 4
 
-extern current_process
 extern set_kernel_stack
+extern proc_switch_finish
 
 global proc_switch_process
-proc_switch_process:         ; void proc_switch_process(process_t* next)
+proc_switch_process:         ; void proc_switch_process(thread_t* next)
     ; Save register state
     push ebx
     push esi
     push edi
     push ebp
 
-    ; eax = current_process
-    mov eax, [current_process]
-    ; current_process->esp = esp
-    mov [eax + 20], esp
+    ; ecx = current thread, found at offset 4 of the per-CPU data
+    mov ecx, [fs:4]
+    ; prev->esp = esp
+    mov [ecx + 16], esp
 
     ; eax = next
-    ; current_process = next
+    ; current thread = next
     mov eax, [esp + 20]
-    mov [current_process], eax
+    mov [fs:4], eax
 
-    ; Set esp0 to the next process's kernel stack in the TSS
+    ; Set esp0 to the next thread's kernel stack in the TSS
     push eax
-    push dword [eax + 16]     ; kernel_stack
+    push ecx
+    push dword [eax + 12]     ; kernel_stack
     call set_kernel_stack
     add esp, 4
+    pop ecx
     pop eax
 
-    ; Switch to the next process's saved kernel stack
-    mov esp, [eax + 20]
+    ; Switch to the next thread's saved kernel stack
+    mov esp, [eax + 16]
 
-    ; Switch page directory
-    mov ebx, [eax + 12]       ; directory
+    ; Switch page directory, unless both threads share it: reloading CR3
+    ; flushes the TLB
+    mov ebx, [eax + 8]        ; directory
+    cmp ebx, [ecx + 8]
+    je .same_directory
     mov cr3, ebx
+.same_directory:
 
-    ; Restore registers from the next process's kernel stack
+    ; We're off the previous thread's stack, let other CPUs have it
+    push ecx
+    call proc_switch_finish
+    add esp, 4
+
+    ; Restore registers from the next thread's kernel stack
     pop ebp
     pop edi
     pop esi
     pop ebx
 
     ret
+
+extern proc_user_work
+extern irq_handler_end
+
+; First return address of user threads, see `proc_init_user_stack`. Work may
+; be pending before they ever reach userspace.
+global proc_user_start
+proc_user_start:
+    call proc_user_work
+    jmp irq_handler_end
@@ -0,0 +1,162 @@
+#include "kernel/sys/ring.h"
+
+#include "kernel/mem/malloc.h"
+#include "kernel/mem/paging.h"
+#include "kernel/mem/pmm.h"
+#include "kernel/sys/proc.h"
+#include "kernel/sys/syscall.h"
+#include "libc/math.h"
+#include "libc/string.h"
+#include "libc/syscall.h"
+
+/* Submission and completion rings, in the fashion of Linux's io_uring. A
+ * process batches system calls in shared memory and has them all run with a
+ * single trap, or none at all when the kernel polls the ring. Entries are run
+ * one after the other through the regular system call handlers, in the
+ * context of the thread entering the ring, so they may block it. A single
+ * thread drains the ring at a time.
+ */
+
+/* Maps a ring with room for at least `entries` submissions in the current
+ * process, and returns its address, or 0 if the process already has one or
+ * `entries` is out of range. The ring pages are ordinary user pages, freed
+ * along with the address space.
+ */
+uintptr_t ring_setup(uint32_t entries, uint32_t flags) {
+    process_t* process = current_process;
+
+    if (!entries || entries > RING_MAX_ENTRIES) {
+        return 0;
+    }
+
+    // Other threads may be setting up a ring too
+    uint32_t irq_flags = spin_lock_irqsave(&process->lock);
+
+    if (process->ring) {
+        spin_unlock_irqrestore(&process->lock, irq_flags);
+        return 0;
+    }
+
+    uint32_t sq_entries = 1;
+
+    while (sq_entries < entries) {
+        sq_entries <<= 1;
+    }
+
+    uint32_t cq_entries = sq_entries * 2;
+    uint32_t sq_offset = align_to(sizeof(ring_header_t), sizeof(ring_sqe_t));
+    uint32_t cq_offset = sq_offset + sq_entries * sizeof(ring_sqe_t);
+    uint32_t num_pages = divide_up(cq_offset + cq_entries * sizeof(ring_cqe_t), 0x1000);
+
+    process->resident_pages += num_pages;
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+        paging_map_page(RING_USER_ADDR + i * 0x1000, pmm_alloc_page(), PAGE_USER | PAGE_RW);
+    }
+
+    memset((void*) RING_USER_ADDR, 0, num_pages * 0x1000);
+
+    ring_header_t* header = (ring_header_t*) RING_USER_ADDR;
+    header->sq_entries = sq_entries;
+    header->cq_entries = cq_entries;
+    header->sq_offset = sq_offset;
+    header->cq_offset = cq_offset;
+    header->flags = flags & RING_SETUP_POLL;
+
+    ring_t* ring = kmalloc(sizeof(ring_t));
+
+    *ring = (ring_t) {.header = header,
+        .sqes = (ring_sqe_t*) (RING_USER_ADDR + sq_offset),
+        .cqes = (ring_cqe_t*) (RING_USER_ADDR + cq_offset),
+        .sq_entries = sq_entries,
+        .cq_entries = cq_entries,
+        .flags = header->flags};
+
+    process->ring = ring;
+    spin_unlock_irqrestore(&process->lock, irq_flags);
+
+    return RING_USER_ADDR;
+}
+
+/* Runs up to `to_submit` pending submissions of the current process, all of
+ * them if zero, and returns how many were consumed. Stops early when the
+ * completion queue is full, and consumes none if another thread is draining
+ * the ring already.
+ */
+uint32_t ring_enter(uint32_t to_submit) {
+    ring_t* ring = current_process->ring;
+
+    if (!ring || !__sync_bool_compare_and_swap(&ring->owner, NULL, current_thread)) {
+        return 0;
+    }
+
+    uint32_t tail = ring->header->sq_tail;
+    uint32_t pending = tail - ring->sq_head;
+    asm volatile("" ::: "memory");
+    uint32_t done = 0;
+
+    // Userspace may have written anything there
+    pending = min(pending, ring->sq_entries);
+
+    if (to_submit) {
+        pending = min(pending, to_submit);
+    }
+
+    while (done < pending) {
+        if (ring->cq_tail - ring->header->cq_head >= ring->cq_entries) {
+            break;
+        }
+
+        // Read the entry once, userspace may still be writing to it
+        ring_sqe_t sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+        REGISTERS regs = {.eax = sqe.opcode, .ebx = sqe.args[0], .ecx = sqe.args[1], .edx = sqe.args[2]};
+
+        ring->sq_head++;
+        ring->header->sq_head = ring->sq_head;
+        done++;
+
+        // Rings don't nest
+        if (sqe.opcode == SYS_RING_SETUP || sqe.opcode == SYS_RING_ENTER) {
+            regs.eax = -1;
+        } else {
+            syscall_handler(&regs);
+        }
+
+        // The ring survives the call, unless the thread exited, in which case
+        // we never get here
+        ring_cqe_t* cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->result = regs.eax;
+
+        asm volatile("" ::: "memory");
+        ring->cq_tail++;
+        ring->header->cq_tail = ring->cq_tail;
+    }
+
+    ring->owner = NULL;
+
+    return done;
+}
+
+/* Drains the ring of `process`, the current process, if it asked to be polled.
+ */
+void ring_poll(process_t* process) {
+    if (ring_polled(process) && process->ring->header->sq_tail != process->ring->sq_head) {
+        ring_enter(0);
+    }
+}
+
+bool ring_polled(process_t* process) {
+    return process->ring && process->ring->flags & RING_SETUP_POLL;
+}
+
+/* Lets other threads drain the ring of `thread`'s process, in case `thread`
+ * exits from one of the entries it was running.
+ */
+void ring_thread_exit(thread_t* thread) {
+    ring_t* ring = thread->process->ring;
+
+    if (ring) {
+        __sync_bool_compare_and_swap(&ring->owner, thread, NULL);
+    }
+}
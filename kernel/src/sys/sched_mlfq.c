@@ -0,0 +1,316 @@
+#include "kernel/sys/sched_mlfq.h"
+
+#include "kernel/cpu/timer.h"
+#include "kernel/mem/malloc.h"
+#include "libc/math.h"
+
+/* Scheduling state of a thread, stored in its `sched_data`. The nodes of a
+ * level form a circular doubly linked list, whose head is run first.
+ */
+typedef struct _mlfq_node_t {
+    thread_t* thread;
+    struct _mlfq_node_t* next;
+    struct _mlfq_node_t* prev;
+    uint32_t level;
+    uint32_t ticks_left; // Remaining allotment at the current level
+} mlfq_node_t;
+
+/* A multi-level feedback queue: level 0 has the highest priority and the
+ * shortest quantum. Threads using up their allotment sink one level, and
+ * every `MLFQ_BOOST_MS` everyone is moved back up to avoid starvation.
+ * The executing thread is kept out of the queues.
+ */
+typedef struct {
+    sched_t sched;
+    mlfq_node_t* levels[MLFQ_LEVELS];
+    uint32_t bitmap; // Bit `n` is set when `levels[n]` isn't empty
+    mlfq_node_t* current;
+    uint32_t ticks_to_boost;
+} sched_mlfq_t;
+
+static const uint32_t mlfq_quantum_ms[MLFQ_LEVELS] = {10, 20, 40, 80, 160, 320, 640, 1280};
+
+static uint32_t mlfq_quantum(uint32_t level) {
+    return TIMER_MS_TO_TICKS(mlfq_quantum_ms[level]);
+}
+
+/* Returns the highest level a thread with the given niceness may run at.
+ * Positive niceness spreads threads over the lower levels.
+ */
+static uint32_t mlfq_base_level(int32_t nice) {
+    if (nice <= 0) {
+        return 0;
+    }
+
+    return nice * MLFQ_LEVELS / (PROC_NICE_MAX + 1);
+}
+
+/* Appends `node` to the queue of its level.
+ */
+static void mlfq_enqueue(sched_mlfq_t* sc, mlfq_node_t* node) {
+    mlfq_node_t* head = sc->levels[node->level];
+
+    if (!head) {
+        node->next = node;
+        node->prev = node;
+        sc->levels[node->level] = node;
+        sc->bitmap |= 1 << node->level;
+    } else {
+        node->next = head;
+        node->prev = head->prev;
+        head->prev->next = node;
+        head->prev = node;
+    }
+}
+
+static void mlfq_dequeue(sched_mlfq_t* sc, mlfq_node_t* node) {
+    if (node->next == node) {
+        sc->levels[node->level] = NULL;
+        sc->bitmap &= ~(1 << node->level);
+    } else {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+
+        if (sc->levels[node->level] == node) {
+            sc->levels[node->level] = node->next;
+        }
+    }
+}
+
+/* Moves every thread back to the highest level its niceness allows.
+ */
+static void mlfq_boost(sched_mlfq_t* sc) {
+    for (uint32_t level = 1; level < MLFQ_LEVELS; level++) {
+        mlfq_node_t* node = sc->levels[level];
+
+        if (!node) {
+            continue;
+        }
+
+        // Detach the whole level first, as nodes may be requeued to it
+        mlfq_node_t* last = node->prev;
+        sc->levels[level] = NULL;
+        sc->bitmap &= ~(1 << level);
+
+        while (true) {
+            mlfq_node_t* next = node->next;
+            bool done = node == last;
+
+            node->level = mlfq_base_level(node->thread->nice);
+            node->ticks_left = mlfq_quantum(node->level);
+            mlfq_enqueue(sc, node);
+
+            if (done) {
+                break;
+            }
+
+            node = next;
+        }
+    }
+
+    if (sc->current) {
+        sc->current->level = mlfq_base_level(sc->current->thread->nice);
+        sc->current->ticks_left = mlfq_quantum(sc->current->level);
+    }
+
+    sc->ticks_to_boost = TIMER_MS_TO_TICKS(MLFQ_BOOST_MS);
+}
+
+/* Elects the head of the highest non-empty level, in constant time.
+ */
+static void mlfq_pick(sched_mlfq_t* sc) {
+    uint32_t level = __builtin_ctz(sc->bitmap);
+    mlfq_node_t* node = sc->levels[level];
+
+    mlfq_dequeue(sc, node);
+    sc->current = node;
+}
+
+thread_t* sched_mlfq_get_current(sched_t* sched) {
+    sched_mlfq_t* sc = (sched_mlfq_t*) sched;
+
+    if (!sc->current && sc->bitmap) {
+        mlfq_pick(sc);
+    }
+
+    return sc->current ? sc->current->thread : NULL;
+}
+
+void sched_mlfq_add(sched_t* sched, thread_t* thread) {
+    sched_mlfq_t* sc = (sched_mlfq_t*) sched;
+    mlfq_node_t* node = kmalloc(sizeof(mlfq_node_t));
+
+    node->thread = thread;
+    node->level = mlfq_base_level(thread->nice);
+    node->ticks_left = mlfq_quantum(node->level);
+    thread->sched_data = node;
+
+    mlfq_enqueue(sc, node);
+}
+
+thread_t* sched_mlfq_next(sched_t* sched) {
+    sched_mlfq_t* sc = (sched_mlfq_t*) sched;
+    mlfq_node_t* node = sc->current;
+
+    // Requeue the preempted thread, one level lower if it used its allotment.
+    // Yielding early keeps the level but not a fresh allotment, so that
+    // threads can't game their way to the top.
+    if (node) {
+        uint32_t base = mlfq_base_level(node->thread->nice);
+
+        if (!node->ticks_left) {
+            node->level = min(node->level + 1, MLFQ_LEVELS - 1);
+            node->ticks_left = mlfq_quantum(node->level);
+        }
+
+        if (node->level < base) {
+            node->level = base;
+            node->ticks_left = mlfq_quantum(base);
+        }
+
+        mlfq_enqueue(sc, node);
+        sc->current = NULL;
+    }
+
+    if (!sc->bitmap) {
+        return NULL;
+    }
+
+    mlfq_pick(sc);
+
+    return sc->current->thread;
+}
+
+void sched_mlfq_exit(sched_t* sched, thread_t* thread) {
+    sched_mlfq_t* sc = (sched_mlfq_t*) sched;
+    mlfq_node_t* node = thread->sched_data;
+
+    if (node == sc->current) {
+        sc->current = NULL;
+    } else {
+        mlfq_dequeue(sc, node);
+    }
+
+    thread->sched_data = NULL;
+    kfree(node);
+}
+
+/* Blocked threads keep their node, and with it their level and allotment.
+ */
+void sched_mlfq_block(sched_t* sched, thread_t* thread) {
+    sched_mlfq_t* sc = (sched_mlfq_t*) sched;
+    mlfq_node_t* node = thread->sched_data;
+
+    if (node == sc->current) {
+        sc->current = NULL;
+    } else {
+        mlfq_dequeue(sc, node);
+    }
+}
+
+/* Requeues a woken up thread. If it has a higher priority than the executing
+ * one, the latter gets preempted on the next tick.
+ */
+void sched_mlfq_unblock(sched_t* sched, thread_t* thread) {
+    mlfq_enqueue((sched_mlfq_t*) sched, thread->sched_data);
+}
+
+/* Gives away the lowest priority thread that isn't executing anywhere, the
+ * one least likely to run here soon. Its level isn't kept, it starts afresh
+ * on the stealing CPU.
+ */
+thread_t* sched_mlfq_steal(sched_t* sched) {
+    sched_mlfq_t* sc = (sched_mlfq_t*) sched;
+
+    for (int32_t level = MLFQ_LEVELS - 1; level >= 0; level--) {
+        mlfq_node_t* head = sc->levels[level];
+
+        if (!head) {
+            continue;
+        }
+
+        mlfq_node_t* node = head->prev;
+
+        while (true) {
+            if (!node->thread->on_cpu) {
+                thread_t* thread = node->thread;
+
+                mlfq_dequeue(sc, node);
+                thread->sched_data = NULL;
+                kfree(node);
+
+                return thread;
+            }
+
+            if (node == head) {
+                break;
+            }
+
+            node = node->prev;
+        }
+    }
+
+    return NULL;
+}
+
+/* Charges ticks to the executing thread. It gets preempted when it runs out
+ * of allotment, or as soon as a higher priority level has work.
+ */
+bool sched_mlfq_tick(sched_t* sched, thread_t* thread, uint32_t ticks) {
+    sched_mlfq_t* sc = (sched_mlfq_t*) sched;
+    mlfq_node_t* node = thread->sched_data;
+
+    node->ticks_left -= min(ticks, node->ticks_left);
+
+    if (ticks >= sc->ticks_to_boost) {
+        mlfq_boost(sc);
+    } else {
+        sc->ticks_to_boost -= ticks;
+    }
+
+    return !node->ticks_left || (sc->bitmap & ((1 << node->level) - 1));
+}
+
+/* The executing thread runs until the end of its allotment or the next boost,
+ * unless it's the only runnable thread.
+ */
+uint32_t sched_mlfq_ticks_left(sched_t* sched, thread_t* thread) {
+    sched_mlfq_t* sc = (sched_mlfq_t*) sched;
+    mlfq_node_t* node = thread->sched_data;
+
+    if (!sc->bitmap) {
+        return 0;
+    }
+
+    if (sc->bitmap & ((1 << node->level) - 1)) {
+        return 1;
+    }
+
+    return max(min(node->ticks_left, sc->ticks_to_boost), 1);
+}
+
+/* Allocates a multi-level feedback queue scheduler.
+ */
+sched_t* sched_mlfq() {
+    sched_mlfq_t* sched = kmalloc(sizeof(sched_mlfq_t));
+
+    sched->sched = (sched_t) {.sched_get_current = sched_mlfq_get_current,
+        .sched_add = sched_mlfq_add,
+        .sched_next = sched_mlfq_next,
+        .sched_exit = sched_mlfq_exit,
+        .sched_tick = sched_mlfq_tick,
+        .sched_ticks_left = sched_mlfq_ticks_left,
+        .sched_block = sched_mlfq_block,
+        .sched_unblock = sched_mlfq_unblock,
+        .sched_steal = sched_mlfq_steal};
+
+    for (uint32_t i = 0; i < MLFQ_LEVELS; i++) {
+        sched->levels[i] = NULL;
+    }
+
+    sched->bitmap = 0;
+    sched->current = NULL;
+    sched->ticks_to_boost = TIMER_MS_TO_TICKS(MLFQ_BOOST_MS);
+
+    return (sched_t*) sched;
+}
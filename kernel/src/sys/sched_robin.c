@@ -1,111 +1,139 @@
 #include "kernel/sys/sched_robin.h"
 
+#include "kernel/cpu/timer.h"
 #include "kernel/mem/malloc.h"
+#include "libc/math.h"
 
-/* Wraps a `process_t*` for round robin purposes.
+/* Wraps a `thread_t*` for round robin purposes.
  */
-typedef struct _proc_node_t {
-    process_t* process;
-    struct _proc_node_t* next;
-} proc_node_t;
+typedef struct _thread_node_t {
+    thread_t* thread;
+    struct _thread_node_t* next;
+} thread_node_t;
 
 /* The round robin scheduler is simple and requires only a single circular list
- * containing candidate processes. By having a `sched_t` as the first member of
+ * containing candidate threads. Blocked threads are taken out of the ring
+ * and put back in when woken up. By having a `sched_t` as the first member of
  * the struct, we allow casting `sched_robin_t*`s to `sched_t*`.
  */
 typedef struct {
     sched_t sched;
-    proc_node_t* processes;
+    thread_node_t* threads;
+    uint32_t ticks_left; // Remaining quantum of the executing thread
 } sched_robin_t;
 
-process_t* sched_robin_get_current(sched_t* sched) {
+thread_t* sched_robin_get_current(sched_t* sched) {
     sched_robin_t* sc = (sched_robin_t*) sched;
 
-    if (sc->processes) {
-        return sc->processes->process;
+    if (sc->threads) {
+        return sc->threads->thread;
     }
 
     return NULL;
 }
 
-void sched_robin_add(sched_t* sched, process_t* new_process) {
+void sched_robin_add(sched_t* sched, thread_t* new_thread) {
     sched_robin_t* sc = (sched_robin_t*) sched;
-    proc_node_t* new = kmalloc(sizeof(proc_node_t));
+    thread_node_t* new = kmalloc(sizeof(thread_node_t));
 
-    new->process = new_process;
+    new->thread = new_thread;
 
-    // Insert the process in the ring, create it if empty
-    if (!sc->processes) {
+    // Insert the thread in the ring, create it if empty
+    if (!sc->threads) {
         new->next = new;
-        sc->processes = new;
+        sc->threads = new;
     } else {
-        proc_node_t* p = sc->processes->next;
-        sc->processes->next = new;
+        thread_node_t* p = sc->threads->next;
+        sc->threads->next = new;
         new->next = p;
     }
 }
 
-process_t* sched_robin_next(sched_t* sched) {
+thread_t* sched_robin_next(sched_t* sched) {
     sched_robin_t* sc = (sched_robin_t*) sched;
-    proc_node_t* p = sc->processes;
-
-    // Avoid switching to a sleeping process if possible
-    do {
-        if (p->next->process->sleep_ticks > 0) {
-            p->next->process->sleep_ticks--;
-        } else {
-            // We don't need to switch process
-            if (p->next == sc->processes) {
-                return sc->processes->process;
-            }
-
-            // We don't need to modify the process queue
-            if (p->next == sc->processes->next) {
-                break;
-            }
-
-            // We insert the next process between the current one and the one
-            // previously scheduled to be switched to.
-            proc_node_t* previous = p;
-            proc_node_t* next_proc = p->next;
-            proc_node_t* moved = sc->processes->next;
-
-            previous->next = next_proc->next;
-            next_proc->next = moved;
-            sc->processes->next = next_proc;
-
-            break;
-        }
 
-        p = p->next;
-    } while (p != sc->processes);
+    if (!sc->threads) {
+        return NULL;
+    }
 
-    sc->processes = sc->processes->next;
+    sc->threads = sc->threads->next;
+    sc->ticks_left = TIMER_MS_TO_TICKS(ROBIN_QUANTUM_MS);
 
-    return sc->processes->process;
+    return sc->threads->thread;
 }
 
-void sched_robin_exit(sched_t* sched, process_t* process) {
+void sched_robin_exit(sched_t* sched, thread_t* thread) {
     sched_robin_t* sc = (sched_robin_t*) sched;
-    proc_node_t* p = sc->processes;
-
-    if (sc->processes == sc->processes->next) {
-        kprintf_error("exiting from the last process");
-        abort();
-    }
+    thread_node_t* p = sc->threads;
 
-    while (p->next->process != process) {
+    while (p->next->thread != thread) {
         p = p->next;
     }
 
-    proc_node_t* to_remove = p->next;
+    thread_node_t* to_remove = p->next;
     p->next = p->next->next;
 
-    sc->processes = p;
+    // The ring may now be empty
+    sc->threads = to_remove == p ? NULL : p;
 
     kfree(to_remove);
 }
 
+/* Gives away a thread that isn't executing anywhere, starting with the one
+ * that would run last here.
+ */
+thread_t* sched_robin_steal(sched_t* sched) {
+    sched_robin_t* sc = (sched_robin_t*) sched;
+
+    if (!sc->threads) {
+        return NULL;
+    }
+
+    // The head of the ring is the executing thread, if any
+    thread_node_t* p = sc->threads;
+
+    while (p->next != sc->threads) {
+        thread_node_t* node = p->next;
+
+        if (!node->thread->on_cpu) {
+            thread_t* thread = node->thread;
+
+            p->next = node->next;
+            kfree(node);
+
+            return thread;
+        }
+
+        p = node;
+    }
+
+    return NULL;
+}
+
+/* Every thread gets the same quantum before being preempted.
+ */
+bool sched_robin_tick(sched_t* sched, thread_t* thread, uint32_t ticks) {
+    sched_robin_t* sc = (sched_robin_t*) sched;
+    unused(thread);
+
+    sc->ticks_left -= min(ticks, sc->ticks_left);
+
+    return !sc->ticks_left;
+}
+
+/* A thread alone in the ring is never preempted.
+ */
+uint32_t sched_robin_ticks_left(sched_t* sched, thread_t* thread) {
+    sched_robin_t* sc = (sched_robin_t*) sched;
+    unused(thread);
+
+    if (!sc->threads || sc->threads->next == sc->threads) {
+        return 0;
+    }
+
+    return max(sc->ticks_left, 1);
+}
+
 /* Allocates a round robin scheduler.
  */
 sched_t* sched_robin() {
@@ -114,9 +142,15 @@ sched_t* sched_robin() {
     sched->sched = (sched_t) {.sched_get_current = sched_robin_get_current,
         .sched_add = sched_robin_add,
         .sched_next = sched_robin_next,
-        .sched_exit = sched_robin_exit};
-
-    sched->processes = NULL;
+        .sched_exit = sched_robin_exit,
+        .sched_tick = sched_robin_tick,
+        .sched_ticks_left = sched_robin_ticks_left,
+        .sched_block = sched_robin_exit,
+        .sched_unblock = sched_robin_add,
+        .sched_steal = sched_robin_steal};
+
+    sched->threads = NULL;
+    sched->ticks_left = TIMER_MS_TO_TICKS(ROBIN_QUANTUM_MS);
 
     return (sched_t*) sched;
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "kernel/sys/softirq.h"
+
+#include "kernel/cpu/cpu.h"
+#include "kernel/kernel.h"
+#include "kernel/sys/preempt.h"
+#include "kernel/sys/proc.h"
+#include "kernel/sys/spinlock.h"
+
+/* Interrupt handlers do the least they can with interrupts disabled, and
+ * raise a softirq for the rest. Pending softirqs of a CPU run with interrupts
+ * enabled on the way out of its outermost interrupt handler, or once the
+ * interrupted code enables preemption again. A source does at most its budget
+ * of work per round, and whatever is still pending after a few rounds is left
+ * to a kernel thread, so that interrupts can't starve threads.
+ * Softirqs run with preemption disabled: they must not block, and stay on the
+ * CPU that raised them. Sources whose handler may leave work behind must be
+ * fine with running on any CPU, concurrently with themselves.
+ */
+
+#define SOFTIRQ_PENDING_OFFSET __builtin_offsetof(cpu_t, softirq_pending)
+
+static softirq_t softirqs[SOFTIRQ_COUNT];
+
+// Runs leftover work, as the threads it's taken from would
+static workqueue_t* softirq_wq;
+
+/* Runs the handler of the softirq `work` belongs to until it's done, giving
+ * the CPU up between budgets.
+ */
+static void softirq_work(work_t* work) {
+    softirq_t* softirq = work->data;
+
+    while (true) {
+        preempt_disable();
+        bool more = softirq->handler(softirq->budget);
+        preempt_enable();
+
+        if (!more) {
+            break;
+        }
+
+        proc_yield();
+    }
+}
+
+/* Creates the thread running leftover softirq work. Sources may be registered
+ * and raised before that, work is only left over once threads run.
+ */
+void init_softirq() {
+    softirq_wq = workqueue_create();
+}
+
+void softirq_register(uint32_t nr, softirq_handler_t handler, uint32_t budget) {
+    softirqs[nr] = (softirq_t) {.handler = handler, .budget = budget};
+    init_work(&softirqs[nr].work, softirq_work, &softirqs[nr]);
+}
+
+/* Marks softirq `nr` pending on the executing CPU. A single instruction, which
+ * interrupt handlers and the code they interrupt can both use.
+ */
+void softirq_raise(uint32_t nr) {
+    asm volatile("orl %0, %%fs:%c1" ::"r"(1u << nr), "i"(SOFTIRQ_PENDING_OFFSET) : "memory");
+}
+
+/* Runs the softirqs pending on the executing CPU, unless they're already
+ * running, or it's in an interrupt handler or with preemption disabled. Called
+ * on interrupt exit and when preemption is enabled again.
+ */
+void softirq_run() {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = cpu_current();
+
+    if (!cpu->softirq_pending || cpu->in_softirq || cpu->irq_depth || cpu->preempt_count) {
+        irq_restore(flags);
+        return;
+    }
+
+    // Interrupts are disabled, a plain increment is enough
+    cpu->preempt_count++;
+    cpu->in_softirq = true;
+
+    for (uint32_t round = 0; round < SOFTIRQ_MAX_ROUNDS && cpu->softirq_pending; round++) {
+        uint32_t pending = cpu->softirq_pending;
+        uint32_t left = 0;
+
+        cpu->softirq_pending = 0;
+        enable_interrupts();
+
+        for (uint32_t nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            softirq_t* softirq = &softirqs[nr];
+
+            if (pending & (1u << nr) && softirq->handler(softirq->budget)) {
+                left |= 1u << nr;
+            }
+        }
+
+        disable_interrupts();
+        cpu->softirq_pending |= left;
+    }
+
+    // Out of rounds: hand the rest over, before the threads starve
+    for (uint32_t nr = 0; nr < SOFTIRQ_COUNT && softirq_wq; nr++) {
+        if (cpu->softirq_pending & (1u << nr)) {
+            cpu->softirq_pending &= ~(1u << nr);
+            queue_work(softirq_wq, &softirqs[nr].work);
+        }
+    }
+
+    cpu->in_softirq = false;
+    cpu->preempt_count--;
+
+    irq_restore(flags);
+}
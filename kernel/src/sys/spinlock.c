@@ -0,0 +1,66 @@
+#include "kernel/sys/spinlock.h"
+
+/* Disables interrupts, and returns whether they were enabled along with the
+ * rest of EFLAGS, to be handed back to `irq_restore`.
+ */
+uint32_t irq_save() {
+    uint32_t flags;
+
+    asm volatile("pushf\n"
+                 "pop %0\n"
+                 "cli\n"
+                 : "=r"(flags)::"memory");
+
+    return flags;
+}
+
+void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        asm volatile("sti" ::: "memory");
+    }
+}
+
+bool irq_enabled() {
+    uint32_t flags;
+
+    asm volatile("pushf\n"
+                 "pop %0\n"
+                 : "=r"(flags));
+
+    return flags & EFLAGS_IF;
+}
+
+void spin_lock(spinlock_t* lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (lock->locked) {
+            asm volatile("pause");
+        }
+    }
+}
+
+/* Takes the lock only if it's free, returns whether it was taken.
+ */
+bool spin_trylock(spinlock_t* lock) {
+    return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+void spin_unlock(spinlock_t* lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+/* Disables interrupts then takes the lock, for locks also taken from interrupt
+ * handlers. Returns the previous interrupt state, to be handed back to
+ * `spin_unlock_irqrestore`.
+ */
+uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = irq_save();
+
+    spin_lock(lock);
+
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
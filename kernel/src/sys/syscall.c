@@ -1,43 +1,316 @@
 #include "kernel/sys/syscall.h"
 
+#include "kernel/cpu/clocksource.h"
+#include "kernel/cpu/cpu.h"
+#include "kernel/cpu/cpuid.h"
 #include "kernel/cpu/isr.h"
+#include "kernel/cpu/msr.h"
 #include "kernel/cpu/timer.h"
 #include "kernel/kernel.h"
 #include "kernel/lib/kprintf.h"
+#include "kernel/mem/paging.h"
+#include "kernel/sys/futex.h"
+#include "kernel/sys/preempt.h"
 #include "kernel/sys/proc.h"
+#include "kernel/sys/ring.h"
+#include "kernel/sys/syscall_stats.h"
 #include "libc/stdio.h"
 #include "libc/stdlib.h"
-
-static void syscall_handler(REGISTERS* regs);
+#include "libc/syscall.h"
 
 static void syscall_yield(REGISTERS* regs);
 static void syscall_exit(REGISTERS* regs);
+static void syscall_thread_exit(REGISTERS* regs);
 static void syscall_wait(REGISTERS* regs);
 static void syscall_putchar(REGISTERS* regs);
+static void syscall_nice(REGISTERS* regs);
+static void syscall_nanosleep(REGISTERS* regs);
+static void syscall_clock_gettime(REGISTERS* regs);
+static void syscall_ring_setup(REGISTERS* regs);
+static void syscall_ring_enter(REGISTERS* regs);
+static void syscall_stats(REGISTERS* regs);
+static void syscall_thread_create(REGISTERS* regs);
+static void syscall_thread_join(REGISTERS* regs);
+static void syscall_futex_wait(REGISTERS* regs);
+static void syscall_futex_wake(REGISTERS* regs);
+static void syscall_set_thread_area(REGISTERS* regs);
+static void syscall_guard_pages(REGISTERS* regs);
+static void syscall_getrusage(REGISTERS* regs);
 
 sys_handler_t syscall_handlers[SYSCALL_NUM] = {0};
 
+// Defined in sysenter.asm
+extern void sysenter_entry();
+
+static bool sysenter;
+
+/* System calls can be made with `int 0x30`, or with the faster SYSENTER when
+ * the CPU has it, see `sysenter.asm` for its ABI.
+ */
 void init_syscall() {
+    sysenter = cpuid(1, 0).edx & CPUID_EDX_SEP;
+    syscall_init_cpu();
+
     isr_register_handler(48, &syscall_handler);
 
-    syscall_handlers[1] = syscall_exit;
-    syscall_handlers[2] = syscall_putchar;
+    syscall_handlers[SYS_EXIT] = syscall_exit;
+    syscall_handlers[SYS_PUTCHAR] = syscall_putchar;
+    syscall_handlers[SYS_YIELD] = syscall_yield;
+    syscall_handlers[SYS_NICE] = syscall_nice;
+    syscall_handlers[SYS_WAIT] = syscall_wait;
+    syscall_handlers[SYS_NANOSLEEP] = syscall_nanosleep;
+    syscall_handlers[SYS_CLOCK_GETTIME] = syscall_clock_gettime;
+    syscall_handlers[SYS_RING_SETUP] = syscall_ring_setup;
+    syscall_handlers[SYS_RING_ENTER] = syscall_ring_enter;
+    syscall_handlers[SYS_SYSCALL_STATS] = syscall_stats;
+    syscall_handlers[SYS_THREAD_CREATE] = syscall_thread_create;
+    syscall_handlers[SYS_THREAD_EXIT] = syscall_thread_exit;
+    syscall_handlers[SYS_THREAD_JOIN] = syscall_thread_join;
+    syscall_handlers[SYS_FUTEX_WAIT] = syscall_futex_wait;
+    syscall_handlers[SYS_FUTEX_WAKE] = syscall_futex_wake;
+    syscall_handlers[SYS_SET_THREAD_AREA] = syscall_set_thread_area;
+    syscall_handlers[SYS_GUARD_PAGES] = syscall_guard_pages;
+    syscall_handlers[SYS_GETRUSAGE] = syscall_getrusage;
+
+    init_syscall_stats();
 }
 
-static void syscall_handler(REGISTERS* regs) {
-    if (syscall_handlers[regs->eax]) {
-        sys_handler_t handler = syscall_handlers[regs->eax];
+/* Points SYSENTER to our entry point on the executing CPU. Its stack pointer
+ * is that CPU's TSS, where the entry point finds the current kernel stack.
+ */
+void syscall_init_cpu() {
+    if (!sysenter) {
+        return;
+    }
+
+    wrmsr(MSR_SYSENTER_CS, 0x08);
+    wrmsr(MSR_SYSENTER_ESP, (uintptr_t) &cpu_current()->tss);
+    wrmsr(MSR_SYSENTER_EIP, (uintptr_t) sysenter_entry);
+}
+
+/* Runs the handler of system call `%eax`, counting and timing it, see
+ * `syscall_stats.c`. Handlers run with interrupts enabled, and may be
+ * preempted unless they disable preemption, see `preempt.c`.
+ */
+void syscall_handler(REGISTERS* regs) {
+    uint32_t num = regs->eax;
+
+    if (num < SYSCALL_NUM && syscall_handlers[num]) {
+        sys_handler_t handler = syscall_handlers[num];
+        uint64_t start = syscall_stats_begin(num);
+        uint32_t flags = irq_save();
+
+        enable_interrupts();
         handler(regs);
+        disable_interrupts();
+        irq_restore(flags);
+
+        syscall_stats_end(num, start);
     } else {
-        kprintf("Unknown syscall %d\n", regs->eax);
+        syscall_stats_unknown();
+        kprintf("Unknown syscall %d\n", num);
     }
+
+    // SYSENTER doesn't go through `isr_irq_handler`, for `int 0x30` doing it
+    // twice is harmless
+    preempt_check_resched();
+    proc_user_work();
+}
+
+/* Returns whether the `size` bytes at `ptr` lie in userspace.
+ */
+static bool syscall_check_range(uintptr_t ptr, uint32_t size) {
+    return ptr && ptr + size >= ptr && ptr + size <= KERNEL_BASE_VIRT;
 }
 
+/* Returns whether the `size` bytes at `ptr` are user memory that handlers can
+ * read, or write to if `write` is set, without faulting, see
+ * `proc_check_user`. Arguments must be checked this way before being
+ * dereferenced: kernel page faults are fatal.
+ */
+static bool syscall_check_ptr(uintptr_t ptr, uint32_t size, bool write) {
+    return syscall_check_range(ptr, size) && proc_check_user(ptr, size, write);
+}
+
+/* Ends the calling process, all of its threads, with status `%ebx`.
+ */
 static void syscall_exit(REGISTERS* regs) {
-    unused(regs);
-    proc_exit();
+    proc_exit_process(regs->ebx);
+}
+
+/* Ends the calling thread with status `%ebx`, and its process along with its
+ * last thread.
+ */
+static void syscall_thread_exit(REGISTERS* regs) {
+    proc_exit(regs->ebx);
 }
 
 static void syscall_putchar(REGISTERS* regs) {
     vbe_print_char((char) regs->ebx);
 }
+
+static void syscall_yield(REGISTERS* regs) {
+    unused(regs);
+    proc_yield();
+}
+
+static void syscall_nice(REGISTERS* regs) {
+    regs->eax = proc_nice((int32_t) regs->ebx);
+}
+
+/* Sleeps for `%ebx` milliseconds.
+ */
+static void syscall_wait(REGISTERS* regs) {
+    proc_sleep((uint64_t) regs->ebx * 1000000);
+}
+
+/* Sleeps for the duration pointed to by `%ebx`, returns -1 if invalid.
+ */
+static void syscall_nanosleep(REGISTERS* regs) {
+    timespec_t* req = (timespec_t*) regs->ebx;
+
+    if (!syscall_check_ptr((uintptr_t) req, sizeof(timespec_t), false) || req->tv_nsec >= 1000000000) {
+        regs->eax = -1;
+        return;
+    }
+
+    regs->eax = 0;
+    proc_sleep((uint64_t) req->tv_sec * 1000000000 + req->tv_nsec);
+}
+
+/* Writes the time of clock `%ebx` to the timespec pointed to by `%ecx`,
+ * returns -1 if either is invalid. Only `CLOCK_MONOTONIC` is supported.
+ */
+static void syscall_clock_gettime(REGISTERS* regs) {
+    timespec_t* ts = (timespec_t*) regs->ecx;
+
+    if (regs->ebx != CLOCK_MONOTONIC || !syscall_check_ptr((uintptr_t) ts, sizeof(timespec_t), true)) {
+        regs->eax = -1;
+        return;
+    }
+
+    clock_ns_to_timespec(clock_monotonic_ns(), ts);
+    regs->eax = 0;
+}
+
+/* Maps a submission ring of `%ebx` entries with flags `%ecx`, returns its
+ * address or 0.
+ */
+static void syscall_ring_setup(REGISTERS* regs) {
+    regs->eax = ring_setup(regs->ebx, regs->ecx);
+}
+
+/* Runs up to `%ebx` pending ring submissions, all of them if zero, returns how
+ * many were consumed.
+ */
+static void syscall_ring_enter(REGISTERS* regs) {
+    regs->eax = ring_enter(regs->ebx);
+}
+
+/* Copies the statistics of system call `%ebx` to the `syscall_stat_t` pointed
+ * to by `%ecx`, system wide or for this process depending on `%edx`. Returns
+ * -1 if the number or the pointer is invalid.
+ */
+static void syscall_stats(REGISTERS* regs) {
+    syscall_stat_t* stat = (syscall_stat_t*) regs->ecx;
+
+    if (!syscall_check_ptr((uintptr_t) stat, sizeof(syscall_stat_t), true)) {
+        regs->eax = -1;
+        return;
+    }
+
+    regs->eax = syscall_stats_get(regs->ebx, regs->edx, stat) ? 0 : -1;
+}
+
+/* Starts a thread at `%ebx` on the stack whose top is `%ecx`, passing it `%edx`
+ * as its only argument. Returns the thread's id, or -1.
+ */
+static void syscall_thread_create(REGISTERS* regs) {
+    regs->eax = proc_thread_create(regs->ebx, regs->ecx, regs->edx);
+}
+
+/* Waits for thread `%ebx` to exit, and stores its exit status at `%ecx` unless
+ * it's NULL. Returns 0, or -1 if the thread can't be joined.
+ */
+static void syscall_thread_join(REGISTERS* regs) {
+    uint32_t* status = (uint32_t*) regs->ecx;
+
+    if (status && !syscall_check_ptr((uintptr_t) status, sizeof(uint32_t), true)) {
+        regs->eax = -1;
+        return;
+    }
+
+    regs->eax = proc_thread_join(regs->ebx, status);
+}
+
+/* Returns whether `addr` is a suitable futex word: aligned and in userspace.
+ * Whether it's mapped is up to `futex.c`, which only faults pages in to wait.
+ */
+static bool syscall_check_futex(uintptr_t addr) {
+    return !(addr & 3) && syscall_check_range(addr, sizeof(uint32_t));
+}
+
+/* Waits on the futex word at `%ebx` as long as it holds `%ecx`, for at most
+ * the duration pointed to by `%edx` unless it's NULL, see `futex_do_wait`.
+ */
+static void syscall_futex_wait(REGISTERS* regs) {
+    timespec_t* timeout = (timespec_t*) regs->edx;
+    uint64_t ns = 0;
+
+    if (!syscall_check_futex(regs->ebx)) {
+        regs->eax = FUTEX_INVALID;
+        return;
+    }
+
+    if (timeout) {
+        if (!syscall_check_ptr((uintptr_t) timeout, sizeof(timespec_t), false) || timeout->tv_nsec >= 1000000000) {
+            regs->eax = FUTEX_INVALID;
+            return;
+        }
+
+        ns = (uint64_t) timeout->tv_sec * 1000000000 + timeout->tv_nsec;
+    }
+
+    regs->eax = futex_do_wait(regs->ebx, regs->ecx, timeout != NULL, ns);
+}
+
+/* Wakes up to `%ecx` threads waiting on the futex word at `%ebx`, returns how
+ * many were woken up, or -1 if the address is invalid.
+ */
+static void syscall_futex_wake(REGISTERS* regs) {
+    if (!syscall_check_futex(regs->ebx)) {
+        regs->eax = -1;
+        return;
+    }
+
+    regs->eax = futex_do_wake(regs->ebx, regs->ecx);
+}
+
+/* Bases the segment selected by `GDT_TLS_SELECTOR`, which threads start with
+ * in %gs, at `%ebx`. Returns 0, or -1 if the address isn't in userspace.
+ */
+static void syscall_set_thread_area(REGISTERS* regs) {
+    regs->eax = proc_set_tls(regs->ebx);
+}
+
+/* Turns the `%ecx` untouched .bss pages at `%ebx` into guard pages, see
+ * `proc_guard`. Returns 0, or -1 if they can't be.
+ */
+static void syscall_guard_pages(REGISTERS* regs) {
+    regs->eax = proc_guard(regs->ebx, regs->ecx);
+}
+
+/* Writes the resource usage of the process, or of the calling thread alone,
+ * depending on `%ebx`, to the rusage pointed to by `%ecx`. Returns -1 if
+ * either is invalid.
+ */
+static void syscall_getrusage(REGISTERS* regs) {
+    rusage_t* usage = (rusage_t*) regs->ecx;
+
+    if (!syscall_check_ptr((uintptr_t) usage, sizeof(rusage_t), true)) {
+        regs->eax = -1;
+        return;
+    }
+
+    regs->eax = proc_getrusage(regs->ebx, usage);
+}
@@ -0,0 +1,60 @@
+section .text
+align 4
+
+extern syscall_handler
+
+; Fast system call entry, see `syscall_init_cpu`. The ABI is register-only:
+;   eax        system call number, and return value
+;   ebx, ecx, edx  arguments, as with `int 0x30`
+;   esi        address to return to
+;   ebp        user stack pointer
+; ecx, edx and the arithmetic flags are clobbered on return.
+;
+; The SYSENTER_ESP MSR points to the CPU's TSS, whose esp0 is the kernel stack
+; of the current process. An interrupt-like frame is built there, so that
+; system call handlers see the usual `REGISTERS`, and may switch processes.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp + 4]    ; esp0 of the TSS
+
+    push dword 0x23       ; ss, user data segment
+    push ebp              ; useresp
+    pushfd                ; eflags, IF was cleared by SYSENTER
+    or dword [esp], 0x200
+    push dword 0x1B       ; cs, user code segment
+    push esi              ; eip
+    push dword 0          ; err_code
+    push dword 48         ; int_no, that of `int 0x30`
+
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov ax, 0x10          ; load kernel data segment
+    mov ds, ax
+    mov es, ax
+    mov gs, ax
+    mov ax, 0x30          ; per-CPU data segment, see `cpu_current`
+    mov fs, ax
+    cld
+
+    push esp
+    call syscall_handler
+    add esp, 4
+
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+
+    add esp, 8            ; int_no and err_code
+
+    ; SYSEXIT returns to eip in edx, with the stack in ecx. Interrupts are
+    ; only taken after the instruction following `sti`.
+    mov edx, [esp]
+    mov ecx, [esp + 12]
+    sti
+    sysexit
@@ -0,0 +1,221 @@
+#include "kernel/sys/syscall_stats.h"
+
+#include "kernel/cpu/cpu.h"
+#include "kernel/cpu/cpuid.h"
+#include "kernel/cpu/serial.h"
+#include "kernel/cpu/tsc.h"
+#include "kernel/mem/malloc.h"
+#include "kernel/sys/preempt.h"
+#include "kernel/sys/proc.h"
+#include "kernel/sys/syscall.h"
+#include "kernel/sys/workqueue.h"
+#include "libc/stdio.h"
+#include "libc/string.h"
+
+/* Every system call is counted and timed at dispatch. Each CPU keeps its own
+ * table, so that recording takes no lock nor atomic operation, only two TSC
+ * reads. Tables are summed up when read. Threads get their own counts, only
+ * ever written by themselves, which are summed up into those of their process.
+ */
+static syscall_stat_t* cpu_stats[CPU_MAX];
+static uint64_t cpu_unknown[CPU_MAX];
+
+static bool has_tsc;
+static work_t dump_work;
+
+static void syscall_stats_dump_work(work_t* work) {
+    unused(work);
+    proc_print_processes();
+    syscall_stats_dump();
+}
+
+static void syscall_stats_rx(char c) {
+    if (c == SYSCALL_STATS_DUMP_KEY) {
+        queue_work(system_wq, &dump_work);
+    }
+}
+
+/* Allocates the tables of every CPU, and has ^T on the serial line dump them
+ * along with the usage of every process.
+ * CPUs must have been counted already, see `init_smp`.
+ */
+void init_syscall_stats() {
+    has_tsc = cpuid(1, 0).edx & CPUID_EDX_TSC;
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_stats[i] = kmalloc(SYSCALL_NUM * sizeof(syscall_stat_t));
+        memset(cpu_stats[i], 0, SYSCALL_NUM * sizeof(syscall_stat_t));
+    }
+
+    init_work(&dump_work, syscall_stats_dump_work, NULL);
+    serial_set_rx_handler(syscall_stats_rx);
+}
+
+/* Counts a call to `num`, and returns the timestamp to hand to
+ * `syscall_stats_end`. Calls that never return, such as `exit`, are still
+ * counted.
+ */
+uint64_t syscall_stats_begin(uint32_t num) {
+    thread_t* thread = current_thread;
+
+    // The tables of this CPU are ours as long as we can't be migrated
+    preempt_disable();
+    cpu_stats[cpu_current()->id][num].count++;
+    preempt_enable();
+
+    if (!thread->syscall_stats) {
+        thread->syscall_stats = kmalloc(SYSCALL_NUM * sizeof(syscall_proc_stat_t));
+        memset(thread->syscall_stats, 0, SYSCALL_NUM * sizeof(syscall_proc_stat_t));
+    }
+
+    thread->syscall_stats[num].count++;
+
+    return has_tsc ? tsc_read() : 0;
+}
+
+static uint32_t syscall_stats_bucket(uint64_t cycles) {
+    if (cycles >> 32) {
+        return SYSCALL_STATS_BUCKETS - 1;
+    }
+
+    if (!cycles) {
+        return 0;
+    }
+
+    return (31 - __builtin_clz((uint32_t) cycles)) / 2;
+}
+
+/* Charges the time since `start` to `num`. The process may have been switched
+ * out meanwhile, and resumed on another CPU.
+ */
+void syscall_stats_end(uint32_t num, uint64_t start) {
+    uint64_t cycles = has_tsc ? tsc_read() - start : 0;
+
+    preempt_disable();
+
+    syscall_stat_t* stat = &cpu_stats[cpu_current()->id][num];
+
+    stat->cycles += cycles;
+    stat->histogram[syscall_stats_bucket(cycles)]++;
+    preempt_enable();
+
+    current_thread->syscall_stats[num].cycles += cycles;
+}
+
+void syscall_stats_unknown() {
+    preempt_disable();
+    cpu_unknown[cpu_current()->id]++;
+    preempt_enable();
+}
+
+/* Sums up the statistics of `num` over all CPUs, or gives those of the current
+ * process, which have no histogram. Returns false if `num` is out of range.
+ * Counters being updated meanwhile may be slightly off.
+ */
+bool syscall_stats_get(uint32_t num, uint32_t scope, syscall_stat_t* stat) {
+    if (num >= SYSCALL_NUM) {
+        return false;
+    }
+
+    memset(stat, 0, sizeof(syscall_stat_t));
+
+    if (scope == SYSCALL_STATS_PROCESS) {
+        process_t* process = current_process;
+        uint32_t flags = spin_lock_irqsave(&process->lock);
+
+        if (process->syscall_stats) {
+            stat->count = process->syscall_stats[num].count;
+            stat->cycles = process->syscall_stats[num].cycles;
+        }
+
+        for (thread_t* thread = process->threads; thread; thread = thread->next) {
+            if (thread->syscall_stats) {
+                stat->count += thread->syscall_stats[num].count;
+                stat->cycles += thread->syscall_stats[num].cycles;
+            }
+        }
+
+        spin_unlock_irqrestore(&process->lock, flags);
+
+        return true;
+    }
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        syscall_stat_t* cpu_stat = &cpu_stats[i][num];
+
+        stat->count += cpu_stat->count;
+        stat->cycles += cpu_stat->cycles;
+
+        for (uint32_t j = 0; j < SYSCALL_STATS_BUCKETS; j++) {
+            stat->histogram[j] += cpu_stat->histogram[j];
+        }
+    }
+
+    return true;
+}
+
+static void syscall_stats_print(const char* format, ...) {
+    char text[256];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    for (char* c = text; *c; c++) {
+        write_serial(*c);
+    }
+}
+
+/* Writes the statistics of every system call made so far to the serial line,
+ * one line per number, followed by its non-empty histogram buckets.
+ */
+/* Adds the counts of the joined `thread` to those of its process. Called with
+ * the process's lock held, returns the table to free once it's released.
+ */
+syscall_proc_stat_t* syscall_stats_join(thread_t* thread) {
+    process_t* process = thread->process;
+    syscall_proc_stat_t* stats = thread->syscall_stats;
+
+    if (!stats || !process->syscall_stats) {
+        // The thread's table becomes the process's, if it has none yet
+        process->syscall_stats = process->syscall_stats ? process->syscall_stats : stats;
+        return NULL;
+    }
+
+    for (uint32_t num = 0; num < SYSCALL_NUM; num++) {
+        process->syscall_stats[num].count += stats[num].count;
+        process->syscall_stats[num].cycles += stats[num].cycles;
+    }
+
+    return stats;
+}
+
+void syscall_stats_dump() {
+    uint64_t unknown = 0;
+    syscall_stat_t stat;
+
+    syscall_stats_print("syscall statistics:\n");
+
+    for (uint32_t num = 0; num < SYSCALL_NUM; num++) {
+        syscall_stats_get(num, SYSCALL_STATS_SYSTEM, &stat);
+
+        if (!stat.count) {
+            continue;
+        }
+
+        syscall_stats_print("  %3u: %llu calls, %llu cycles avg\n", num, stat.count, stat.cycles / stat.count);
+
+        for (uint32_t i = 0; i < SYSCALL_STATS_BUCKETS; i++) {
+            if (stat.histogram[i]) {
+                syscall_stats_print("       >= 4^%-2u cycles: %u\n", i, stat.histogram[i]);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        unknown += cpu_unknown[i];
+    }
+
+    syscall_stats_print("  unknown: %llu calls\n", unknown);
+}
@@ -0,0 +1,279 @@
+#include "kernel/sys/wheel.h"
+
+#include "kernel/sys/spinlock.h"
+#include "libc/math.h"
+
+/* A hierarchical timer wheel, in the fashion of the classic Linux one.
+ * Timers due within `WHEEL_ROOT_SIZE` ticks sit in the root level, indexed by
+ * their expiry tick. Timers further away are hashed into coarser levels and
+ * cascaded down one level each time the level below wraps around. Adding and
+ * removing timers is O(1), and each timer is cascaded at most `WHEEL_LEVELS`
+ * times, so expiring timers costs O(1) amortized whatever their number.
+ */
+
+static wheel_timer_t* root[WHEEL_ROOT_SIZE];
+static wheel_timer_t* levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+
+// Bit `n` is set when `root[n]` isn't empty, see `wheel_next_expiry`
+static uint32_t root_bitmap[WHEEL_ROOT_SIZE / 32];
+
+// The next tick to be processed
+static uint32_t wheel_now;
+// Set when `wheel_run` ran out of budget before the end of the last tick
+static bool wheel_partial;
+
+// Protects all of the above, timers may be added from any CPU
+static spinlock_t wheel_lock = SPINLOCK_INIT;
+
+static bool wheel_is_root(wheel_timer_t** slot) {
+    return slot >= &root[0] && slot < &root[WHEEL_ROOT_SIZE];
+}
+
+static void wheel_link(wheel_timer_t** slot, wheel_timer_t* timer) {
+    if (wheel_is_root(slot)) {
+        uint32_t index = slot - root;
+        root_bitmap[index / 32] |= 1u << (index % 32);
+    }
+
+    timer->next = *slot;
+    timer->pprev = slot;
+
+    if (*slot) {
+        (*slot)->pprev = &timer->next;
+    }
+
+    *slot = timer;
+}
+
+static void wheel_unlink(wheel_timer_t* timer) {
+    *timer->pprev = timer->next;
+
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    } else if (wheel_is_root(timer->pprev) && !*timer->pprev) {
+        // `pprev` points to the slot itself only for the first timer of a slot
+        uint32_t index = timer->pprev - root;
+        root_bitmap[index / 32] &= ~(1u << (index % 32));
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/* Returns the slot `timer` belongs to, relative to `wheel_now`.
+ */
+static wheel_timer_t** wheel_slot(wheel_timer_t* timer) {
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - wheel_now;
+
+    // Already due, run it on the next processed tick
+    if ((int32_t) delta < 0) {
+        return &root[wheel_now & WHEEL_ROOT_MASK];
+    }
+
+    if (delta < WHEEL_ROOT_SIZE) {
+        return &root[expires & WHEEL_ROOT_MASK];
+    }
+
+    uint32_t level = 0;
+    uint32_t shift = WHEEL_ROOT_BITS;
+
+    // The last level catches everything else
+    while (level < WHEEL_LEVELS - 1 && delta >= (1u << (shift + WHEEL_LEVEL_BITS))) {
+        level++;
+        shift += WHEEL_LEVEL_BITS;
+    }
+
+    return &levels[level][(expires >> shift) & WHEEL_LEVEL_MASK];
+}
+
+/* Moves every timer of the given slot to its place in the lower levels.
+ */
+static void wheel_cascade(uint32_t level, uint32_t index) {
+    wheel_timer_t* timer = levels[level][index];
+
+    while (timer) {
+        wheel_timer_t* next = timer->next;
+
+        wheel_unlink(timer);
+        wheel_link(wheel_slot(timer), timer);
+
+        timer = next;
+    }
+}
+
+/* Arms `timer` to have its callback called once the tick count reaches
+ * `timer->expires`. The callback is run from the timer softirq, see
+ * `timer_softirq`, with interrupts enabled.
+ */
+void wheel_add(wheel_timer_t* timer) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+
+    if (timer->pprev) {
+        wheel_unlink(timer);
+    }
+
+    wheel_link(wheel_slot(timer), timer);
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+/* Same as `wheel_add`, for tick `expires`. Returns whether the timer was
+ * pending.
+ */
+bool wheel_mod(wheel_timer_t* timer, uint32_t expires) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    bool pending = timer->pprev != NULL;
+
+    if (pending) {
+        wheel_unlink(timer);
+    }
+
+    timer->expires = expires;
+    wheel_link(wheel_slot(timer), timer);
+    spin_unlock_irqrestore(&wheel_lock, flags);
+
+    return pending;
+}
+
+/* Disarms `timer`, which may or may not be pending. Returns whether it was.
+ */
+bool wheel_del(wheel_timer_t* timer) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    bool pending = timer->pprev != NULL;
+
+    if (pending) {
+        wheel_unlink(timer);
+    }
+
+    spin_unlock_irqrestore(&wheel_lock, flags);
+
+    return pending;
+}
+
+bool wheel_pending(wheel_timer_t* timer) {
+    return timer->pprev != NULL;
+}
+
+/* Finds when the next timer expires, for the timer to sleep until then.
+ * Timers in the upper levels aren't looked at individually: they are only
+ * known to expire after the root level wraps around, which is returned
+ * instead. Returns false if no timer is pending.
+ */
+static bool wheel_find_expiry(uint32_t* expires) {
+    for (uint32_t i = 0; i < WHEEL_ROOT_SIZE; i++) {
+        uint32_t index = (wheel_now + i) & WHEEL_ROOT_MASK;
+
+        // Skip empty words of the bitmap at once
+        if (!root_bitmap[index / 32] && index % 32 == 0) {
+            i += 31;
+            continue;
+        }
+
+        if (root_bitmap[index / 32] & (1u << (index % 32))) {
+            *expires = wheel_now + i;
+            return true;
+        }
+    }
+
+    for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        for (uint32_t i = 0; i < WHEEL_LEVEL_SIZE; i++) {
+            if (levels[level][i]) {
+                *expires = align_to(wheel_now, WHEEL_ROOT_SIZE);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool wheel_next_expiry(uint32_t* expires) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    bool found = wheel_find_expiry(expires);
+
+    spin_unlock_irqrestore(&wheel_lock, flags);
+
+    return found;
+}
+
+/* Runs the callbacks of the due timers of `slot`, that of the tick before
+ * `wheel_now`, as long as `*budget` allows. Returns false if it ran out with
+ * some left. Called with the lock held, which callbacks run without, as they
+ * usually add timers.
+ */
+static bool wheel_expire(wheel_timer_t** slot, uint32_t* budget, uint32_t* flags) {
+    wheel_timer_t* timer = *slot;
+
+    while (timer) {
+        // Timers added by callbacks a whole turn of the root level away land
+        // in this slot as well
+        if ((int32_t) (timer->expires - wheel_now) >= 0) {
+            timer = timer->next;
+            continue;
+        }
+
+        if (!*budget) {
+            return false;
+        }
+
+        (*budget)--;
+        wheel_unlink(timer);
+
+        spin_unlock_irqrestore(&wheel_lock, *flags);
+        timer->callback(timer);
+        *flags = spin_lock_irqsave(&wheel_lock);
+
+        // The slot may have changed in the meantime
+        timer = *slot;
+    }
+
+    return true;
+}
+
+/* Runs the callbacks of the timers expiring up to tick `now`, included, at
+ * most `budget` of them. Returns whether some are left, which the next call
+ * runs first.
+ */
+bool wheel_run(uint32_t now, uint32_t budget) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+
+    if (wheel_partial && !wheel_expire(&root[(wheel_now - 1) & WHEEL_ROOT_MASK], &budget, &flags)) {
+        spin_unlock_irqrestore(&wheel_lock, flags);
+        return true;
+    }
+
+    wheel_partial = false;
+
+    while ((int32_t) (now - wheel_now) >= 0) {
+        uint32_t index = wheel_now & WHEEL_ROOT_MASK;
+
+        // The root level wrapped around: pull the next batch from above,
+        // going up as long as levels wrap around as well
+        if (!index) {
+            uint32_t shift = WHEEL_ROOT_BITS;
+
+            for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+                uint32_t level_index = (wheel_now >> shift) & WHEEL_LEVEL_MASK;
+                wheel_cascade(level, level_index);
+
+                if (level_index) {
+                    break;
+                }
+
+                shift += WHEEL_LEVEL_BITS;
+            }
+        }
+
+        wheel_now++;
+
+        if (!wheel_expire(&root[index], &budget, &flags)) {
+            wheel_partial = true;
+            spin_unlock_irqrestore(&wheel_lock, flags);
+            return true;
+        }
+    }
+
+    spin_unlock_irqrestore(&wheel_lock, flags);
+
+    return false;
+}
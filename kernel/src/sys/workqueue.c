@@ -0,0 +1,92 @@
+#include "kernel/sys/workqueue.h"
+
+#include "kernel/mem/malloc.h"
+#include "kernel/sys/kthread.h"
+#include "kernel/sys/proc.h"
+
+workqueue_t* system_wq = NULL;
+
+/* Runs the work of `arg`, a workqueue, sleeping whenever there's none. Work
+ * runs with interrupts enabled, the lock is taken with them disabled as work
+ * may be queued from interrupt handlers.
+ */
+static void workqueue_worker(void* arg) {
+    workqueue_t* wq = arg;
+
+    while (true) {
+        uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+        // The lock is dropped only once we're marked as blocked, so work
+        // queued in the meantime still wakes us up
+        while (!wq->head) {
+            proc_block_on(&wq->lock);
+            spin_lock(&wq->lock);
+        }
+
+        work_t* work = wq->head;
+        wq->head = work->next;
+
+        if (!wq->head) {
+            wq->tail = NULL;
+        }
+
+        // The work may queue itself again from here on
+        work->pending = false;
+        spin_unlock_irqrestore(&wq->lock, flags);
+
+        work->func(work);
+    }
+}
+
+/* Creates the shared workqueue, for work that doesn't need its own thread.
+ */
+void init_workqueue() {
+    system_wq = workqueue_create();
+}
+
+workqueue_t* workqueue_create() {
+    workqueue_t* wq = kmalloc(sizeof(workqueue_t));
+
+    wq->head = NULL;
+    wq->tail = NULL;
+    wq->lock = (spinlock_t) SPINLOCK_INIT;
+    wq->worker = kthread_create(workqueue_worker, wq);
+
+    return wq;
+}
+
+void init_work(work_t* work, void (*func)(work_t*), void* data) {
+    work->next = NULL;
+    work->func = func;
+    work->data = data;
+    work->pending = false;
+}
+
+/* Queues `work` to be run by the worker of `wq`, out of the current context.
+ * Safe to call from interrupt handlers. Returns false if `work` was already
+ * pending, in which case it still runs only once.
+ */
+bool queue_work(workqueue_t* wq, work_t* work) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    if (work->pending) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        return false;
+    }
+
+    work->pending = true;
+    work->next = NULL;
+
+    if (wq->tail) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+
+    wq->tail = work;
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    proc_unblock(wq->worker);
+
+    return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Stackful coroutines, scheduled cooperatively within a single thread. A
+// switch saves four registers and swaps stacks, see `coro_switch`. Stacks come
+// from a pool carved out of memory given to `coro_init`, each with a guard
+// page below it.
+
+#define CORO_PAGE_SIZE 0x1000
+
+// Sleepers are only looked at every so many switches while others can run
+#define CORO_SLEEP_CHECK 64
+
+struct _coro_sched_t;
+
+typedef void (*coro_func_t)(struct _coro_sched_t* sched, void* arg);
+
+typedef struct _coro_t {
+    uint32_t esp; // Saved stack pointer, see `coro_switch`
+    struct _coro_t* next;
+    coro_func_t func;
+    void* arg;
+    uint64_t wake_ns; // When to resume a sleeping coroutine
+} coro_t;
+
+typedef struct {
+    uint8_t* base;
+    uint32_t slot_size; // Guard page included
+    uint32_t num_slots;
+    uint32_t next_slot; // Slots past this one were never used
+    coro_t* free;
+    bool guarded; // Whether the guard pages could be set up
+} coro_pool_t;
+
+typedef struct _coro_sched_t {
+    uint32_t esp; // Stack pointer of `coro_run`
+    coro_t* current;
+    // Runnable coroutines, first in first out
+    coro_t* head;
+    coro_t* tail;
+    // Sleeping coroutines, soonest first
+    coro_t* sleeping;
+    // Finished coroutine whose stack is still in use, see `coro_reap`
+    coro_t* dead;
+    uint32_t switches;
+    coro_pool_t pool;
+} coro_sched_t;
+
+// Switches stacks, saving the current stack pointer to 'save'. Defined in
+// switch.asm.
+void coro_switch(uint32_t* save, uint32_t esp);
+
+// Sets up a scheduler whose stacks of 'stack_size' bytes are carved out of
+// the 'size' bytes at 'memory', which must be page aligned. Guard pages are
+// only set up if the memory is untouched .bss. Returns how many coroutines
+// may exist at once.
+uint32_t coro_init(coro_sched_t* sched, void* memory, uint32_t size, uint32_t stack_size);
+
+// Creates a coroutine running 'func(sched, arg)', to be started by
+// `coro_run`. Returns NULL if the pool is exhausted.
+coro_t* coro_spawn(coro_sched_t* sched, coro_func_t func, void* arg);
+
+// Runs coroutines until all of them have returned. Sleeps in the kernel when
+// only sleeping coroutines are left.
+void coro_run(coro_sched_t* sched);
+
+// Lets other coroutines run, from within a coroutine.
+void coro_yield(coro_sched_t* sched);
+
+// Suspends the calling coroutine for at least 'ns' nanoseconds, letting others
+// run instead of blocking the thread in the kernel.
+void coro_sleep(coro_sched_t* sched, uint64_t ns);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "libc/stdint.h"
+#include "libc/time.h"
+
+// Whose usage `getrusage` returns
+#define RUSAGE_SELF 0   // The calling process, all threads included
+#define RUSAGE_THREAD 1 // The calling thread
+
+/* Resources used so far. CPU time is measured when threads are switched, and
+ * split between userspace and the kernel in proportion to where timer
+ * interrupts found them.
+ */
+typedef struct {
+    timespec_t ru_utime; // Time spent in userspace
+    timespec_t ru_stime; // Time spent in the kernel
+    uint32_t ru_maxrss;  // Resident memory of the process, in kilobytes
+    uint32_t ru_minflt;  // Pages mapped on first access
+    uint32_t ru_nvcsw;   // Context switches from blocking or exiting
+    uint32_t ru_nivcsw;  // Context switches from preemption or yielding
+} rusage_t;
+
+// Returns 0, or -1 if `who` is invalid
+int getrusage(int who, rusage_t* usage);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// System call numbers, see `init_syscall` in the kernel
+#define SYS_EXIT 1
+#define SYS_PUTCHAR 2
+#define SYS_YIELD 3
+#define SYS_NICE 4
+#define SYS_WAIT 5
+#define SYS_NANOSLEEP 6
+#define SYS_CLOCK_GETTIME 7
+#define SYS_RING_SETUP 8
+#define SYS_RING_ENTER 9
+#define SYS_SYSCALL_STATS 10
+#define SYS_THREAD_CREATE 11
+#define SYS_THREAD_EXIT 12
+#define SYS_THREAD_JOIN 13
+#define SYS_FUTEX_WAIT 14
+#define SYS_FUTEX_WAKE 15
+#define SYS_SET_THREAD_AREA 16
+#define SYS_GUARD_PAGES 17
+#define SYS_GETRUSAGE 18
+
+// Returned by `SYS_FUTEX_WAIT` when not woken up
+#define FUTEX_INVALID -1  // Bad address or timeout
+#define FUTEX_AGAIN -2    // The word didn't hold the expected value
+#define FUTEX_TIMEDOUT -3
+
+uint32_t syscall3(uint32_t num, uint32_t a, uint32_t b, uint32_t c);
+
+static inline uint32_t syscall2(uint32_t num, uint32_t a, uint32_t b) {
+    return syscall3(num, a, b, 0);
+}
+
+static inline uint32_t syscall1(uint32_t num, uint32_t a) {
+    return syscall3(num, a, 0, 0);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "libc/stdint.h"
+#include "libc/time.h"
+
+// Locks for threads and processes sharing memory. Taking a free lock, and
+// releasing one nobody waits on, never enters the kernel. Timeouts are
+// relative, and NULL means no timeout.
+
+typedef struct {
+    volatile uint32_t state; // 0: unlocked, 1: locked, 2: locked with waiters
+} mutex_t;
+
+typedef struct {
+    volatile uint32_t seq; // Bumped by every signal
+    volatile uint32_t waiters;
+} cond_t;
+
+typedef struct {
+    volatile uint32_t value;
+    volatile uint32_t waiters;
+} sem_t;
+
+#define TCB_SLOTS 8
+
+// Thread control block, reached through %gs once registered with `tcb_set`.
+// Each thread has its own, so that its members cost a single load.
+typedef struct _tcb_t {
+    struct _tcb_t* self;    // Must stay first, see `tcb_get`
+    int error;              // Error code of the last failed call, as `errno`
+    void* slots[TCB_SLOTS]; // Free for libraries, e.g. allocator caches
+} tcb_t;
+
+#define MUTEX_INIT {.state = 0}
+#define COND_INIT {.seq = 0, .waiters = 0}
+
+// Sleeps as long as '*addr' holds 'val', until woken up or timed out.
+// Returns 0 once woken up, or one of the FUTEX_* errors of "libc/syscall.h".
+int32_t futex_wait(volatile uint32_t* addr, uint32_t val, const timespec_t* timeout);
+
+// Wakes up to 'num' threads sleeping on 'addr', returns how many were.
+int32_t futex_wake(volatile uint32_t* addr, uint32_t num);
+
+void mutex_init(mutex_t* mutex);
+void mutex_lock(mutex_t* mutex);
+// Returns true if the mutex was free and is now held
+bool mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+void cond_init(cond_t* cond);
+// Releases 'mutex', which must be held, and waits for a signal. The mutex is
+// held again on return. Returns -1 on timeout, 0 otherwise, spurious wakeups
+// included.
+int cond_timedwait(cond_t* cond, mutex_t* mutex, const timespec_t* timeout);
+void cond_wait(cond_t* cond, mutex_t* mutex);
+// Wakes up one waiter, or all of them
+void cond_signal(cond_t* cond);
+void cond_broadcast(cond_t* cond);
+
+void sem_init(sem_t* sem, uint32_t value);
+// Decrements the semaphore, waiting for it to be positive first. Returns -1 on
+// timeout, 0 otherwise.
+int sem_timedwait(sem_t* sem, const timespec_t* timeout);
+void sem_wait(sem_t* sem);
+// Returns true if the semaphore was positive and has been decremented
+bool sem_trywait(sem_t* sem);
+void sem_post(sem_t* sem);
+
+// Makes 'tcb' the control block of the calling thread. Returns -1 on failure.
+int tcb_set(tcb_t* tcb);
+
+// Returns the control block of the calling thread, see `tcb_set`.
+static inline tcb_t* tcb_get() {
+    tcb_t* tcb;
+
+    asm("mov %%gs:0, %0" : "=r"(tcb));
+
+    return tcb;
+}
+
+static inline int tcb_get_error() {
+    int error;
+
+    asm volatile("mov %%gs:%c1, %0" : "=r"(error) : "i"(__builtin_offsetof(tcb_t, error)));
+
+    return error;
+}
+
+static inline void tcb_set_error(int error) {
+    asm volatile("mov %0, %%gs:%c1" : : "r"(error), "i"(__builtin_offsetof(tcb_t, error)) : "memory");
+}
+
+static inline void* tcb_get_slot(uint32_t slot) {
+    void* value;
+
+    asm volatile("mov %%gs:%c1(,%2,4), %0"
+                 : "=r"(value)
+                 : "i"(__builtin_offsetof(tcb_t, slots)), "r"(slot));
+
+    return value;
+}
+
+static inline void tcb_set_slot(uint32_t slot, void* value) {
+    asm volatile("mov %0, %%gs:%c1(,%2,4)"
+                 :
+                 : "r"(value), "i"(__builtin_offsetof(tcb_t, slots)), "r"(slot)
+                 : "memory");
+}
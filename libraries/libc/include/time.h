@@ -0,0 +1,12 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// The only clock of the `clock_gettime` system call
+#define CLOCK_MONOTONIC 1
+
+// A duration or a point in time, as used by system calls
+typedef struct {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} timespec_t;
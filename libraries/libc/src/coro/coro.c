@@ -0,0 +1,217 @@
+#include "libc/coro.h"
+
+#include "libc/math.h"
+#include "libc/string.h"
+#include "libc/syscall.h"
+#include "libc/time.h"
+
+#define NS_PER_SEC 1000000000
+
+static uint64_t coro_now() {
+    timespec_t ts;
+
+    syscall2(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (uintptr_t) &ts);
+
+    return (uint64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+uint32_t coro_init(coro_sched_t* sched, void* memory, uint32_t size, uint32_t stack_size) {
+    memset(sched, 0, sizeof(coro_sched_t));
+
+    coro_pool_t* pool = &sched->pool;
+
+    pool->base = memory;
+    pool->slot_size = align_to(stack_size, CORO_PAGE_SIZE) + CORO_PAGE_SIZE;
+    pool->num_slots = size / pool->slot_size;
+    pool->guarded = pool->num_slots > 0;
+
+    // The lowest page of each slot catches overflows of the stack above it
+    for (uint32_t i = 0; i < pool->num_slots && pool->guarded; i++) {
+        uintptr_t guard = (uintptr_t) pool->base + i * pool->slot_size;
+
+        pool->guarded = syscall2(SYS_GUARD_PAGES, guard, 1) == 0;
+    }
+
+    return pool->num_slots;
+}
+
+/* Returns a free slot, described by the `coro_t` at its top, or NULL.
+ */
+static coro_t* coro_pool_alloc(coro_pool_t* pool) {
+    coro_t* coro = pool->free;
+
+    if (coro) {
+        pool->free = coro->next;
+        return coro;
+    }
+
+    if (pool->next_slot == pool->num_slots) {
+        return NULL;
+    }
+
+    uint8_t* slot = pool->base + pool->next_slot++ * pool->slot_size;
+
+    // Slots are page aligned, so this keeps the stack top 16 bytes aligned
+    return (coro_t*) (slot + pool->slot_size - align_to(sizeof(coro_t), 16));
+}
+
+static void coro_pool_free(coro_pool_t* pool, coro_t* coro) {
+    coro->next = pool->free;
+    pool->free = coro;
+}
+
+static void coro_enqueue(coro_sched_t* sched, coro_t* coro) {
+    coro->next = NULL;
+
+    if (sched->tail) {
+        sched->tail->next = coro;
+    } else {
+        sched->head = coro;
+    }
+
+    sched->tail = coro;
+}
+
+static coro_t* coro_dequeue(coro_sched_t* sched) {
+    coro_t* coro = sched->head;
+
+    if (coro) {
+        sched->head = coro->next;
+
+        if (!sched->head) {
+            sched->tail = NULL;
+        }
+    }
+
+    return coro;
+}
+
+/* Makes the sleeping coroutines due at `now` runnable.
+ */
+static void coro_wake(coro_sched_t* sched, uint64_t now) {
+    while (sched->sleeping && sched->sleeping->wake_ns <= now) {
+        coro_t* coro = sched->sleeping;
+
+        sched->sleeping = coro->next;
+        coro_enqueue(sched, coro);
+    }
+}
+
+/* Gives the stack of a finished coroutine back to the pool. Called by whoever
+ * runs after it, as it can't free the stack it runs on.
+ */
+static void coro_reap(coro_sched_t* sched) {
+    if (sched->dead) {
+        coro_pool_free(&sched->pool, sched->dead);
+        sched->dead = NULL;
+    }
+}
+
+/* Switches from the current coroutine, which must have been queued, put to
+ * sleep or marked as dead, to the next runnable one. Goes back to `coro_run`
+ * if there's none.
+ */
+static void coro_schedule(coro_sched_t* sched) {
+    coro_t* self = sched->current;
+    coro_t* next = coro_dequeue(sched);
+
+    sched->current = next;
+    sched->switches++;
+
+    if (next == self) {
+        return;
+    }
+
+    coro_switch(&self->esp, next ? next->esp : sched->esp);
+    coro_reap(sched);
+}
+
+/* First function of every coroutine, see `coro_spawn`.
+ */
+static void coro_entry(coro_sched_t* sched) {
+    coro_t* self = sched->current;
+
+    coro_reap(sched);
+    self->func(sched, self->arg);
+
+    sched->dead = self;
+    coro_schedule(sched);
+}
+
+coro_t* coro_spawn(coro_sched_t* sched, coro_func_t func, void* arg) {
+    coro_t* coro = coro_pool_alloc(&sched->pool);
+
+    if (!coro) {
+        return NULL;
+    }
+
+    coro->func = func;
+    coro->arg = arg;
+
+    // Laid out for `coro_switch` to return to `coro_entry(sched)`, with the
+    // argument 16 bytes aligned as the i386 ABI wants
+    uint32_t* stack = (uint32_t*) coro;
+
+    stack -= 3;
+    *--stack = (uintptr_t) sched;
+    *--stack = 0; // `coro_entry`'s return address, it never returns
+    *--stack = (uintptr_t) coro_entry;
+    stack -= 4; // %ebp, %ebx, %esi, %edi
+
+    coro->esp = (uintptr_t) stack;
+    coro_enqueue(sched, coro);
+
+    return coro;
+}
+
+void coro_run(coro_sched_t* sched) {
+    while (sched->head || sched->sleeping) {
+        if (sched->sleeping) {
+            coro_wake(sched, coro_now());
+        }
+
+        coro_t* next = coro_dequeue(sched);
+
+        // Only sleepers are left, so the thread may as well sleep
+        if (!next) {
+            uint64_t ns = sched->sleeping->wake_ns - coro_now();
+            timespec_t ts = {.tv_sec = ns / NS_PER_SEC, .tv_nsec = ns % NS_PER_SEC};
+
+            if ((int64_t) ns > 0) {
+                syscall1(SYS_NANOSLEEP, (uintptr_t) &ts);
+            }
+
+            continue;
+        }
+
+        sched->current = next;
+        coro_switch(&sched->esp, next->esp);
+        coro_reap(sched);
+    }
+}
+
+void coro_yield(coro_sched_t* sched) {
+    // Checking the clock costs a system call, so it's only done now and then
+    if (sched->sleeping && sched->switches % CORO_SLEEP_CHECK == 0) {
+        coro_wake(sched, coro_now());
+    }
+
+    coro_enqueue(sched, sched->current);
+    coro_schedule(sched);
+}
+
+void coro_sleep(coro_sched_t* sched, uint64_t ns) {
+    coro_t* self = sched->current;
+    coro_t** link = &sched->sleeping;
+
+    self->wake_ns = coro_now() + ns;
+
+    while (*link && (*link)->wake_ns <= self->wake_ns) {
+        link = &(*link)->next;
+    }
+
+    self->next = *link;
+    *link = self;
+
+    coro_schedule(sched);
+}
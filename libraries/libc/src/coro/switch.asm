@@ -0,0 +1,25 @@
+section .text
+align 4
+
+; void coro_switch(uint32_t* save, uint32_t esp)
+; Saves the callee-saved registers on the current stack, stores the stack
+; pointer to `save` and resumes the stack at `esp`, saved the same way.
+global coro_switch
+coro_switch:
+    mov eax, [esp + 4]    ; save
+    mov edx, [esp + 8]    ; esp
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov [eax], esp
+    mov esp, edx
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+
+    ret
@@ -0,0 +1,6 @@
+#include "libc/resource.h"
+#include "libc/syscall.h"
+
+int getrusage(int who, rusage_t* usage) {
+    return syscall2(SYS_GETRUSAGE, who, (uintptr_t) usage);
+}
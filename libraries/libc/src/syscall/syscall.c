@@ -0,0 +1,41 @@
+#include "libc/syscall.h"
+
+#define SYSCALL_CPUID_EDX_SEP (1 << 11)
+
+// Defined in sysenter.asm
+extern uint32_t syscall_sysenter(uint32_t num, uint32_t a, uint32_t b, uint32_t c);
+
+// Whether the CPU has SYSENTER, checked on the first system call. Threads
+// racing to check it all find the same answer.
+static enum { SYSCALL_UNKNOWN, SYSCALL_INT, SYSCALL_SYSENTER } syscall_mode;
+
+/* Tells whether the CPU has SYSENTER, in which case the kernel sets it up, see
+ * `init_syscall` in the kernel.
+ */
+static bool syscall_has_sysenter() {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+
+    return edx & SYSCALL_CPUID_EDX_SEP;
+}
+
+/* Makes a system call through SYSENTER when the CPU has it, or `int 0x30`
+ * otherwise. Arguments go in %ebx, %ecx and %edx, the result comes back in
+ * %eax.
+ */
+uint32_t syscall3(uint32_t num, uint32_t a, uint32_t b, uint32_t c) {
+    if (syscall_mode == SYSCALL_UNKNOWN) {
+        syscall_mode = syscall_has_sysenter() ? SYSCALL_SYSENTER : SYSCALL_INT;
+    }
+
+    if (syscall_mode == SYSCALL_SYSENTER) {
+        return syscall_sysenter(num, a, b, c);
+    }
+
+    uint32_t ret;
+
+    asm volatile("int $0x30" : "=a"(ret) : "a"(num), "b"(a), "c"(b), "d"(c) : "memory");
+
+    return ret;
+}
@@ -0,0 +1,26 @@
+section .text
+align 4
+
+; uint32_t syscall_sysenter(uint32_t num, uint32_t a, uint32_t b, uint32_t c)
+; Makes a system call through SYSENTER, see `sysenter.asm` in the kernel for
+; its ABI. Only to be used when the CPU has it, see `syscall3`.
+global syscall_sysenter
+syscall_sysenter:
+    push ebp
+    push ebx
+    push esi
+
+    mov eax, [esp + 16]   ; num
+    mov ebx, [esp + 20]   ; a
+    mov ecx, [esp + 24]   ; b
+    mov edx, [esp + 28]   ; c
+    mov esi, .ret         ; return address
+    mov ebp, esp          ; user stack pointer
+    sysenter
+.ret:
+
+    pop esi
+    pop ebx
+    pop ebp
+
+    ret
@@ -0,0 +1,46 @@
+#include "libc/syscall.h"
+#include "libc/thread.h"
+
+void cond_init(cond_t* cond) {
+    cond->seq = 0;
+    cond->waiters = 0;
+}
+
+int cond_timedwait(cond_t* cond, mutex_t* mutex, const timespec_t* timeout) {
+    // Registered before the sequence number is read: a signaler that misses
+    // us bumped it first, and can only have been before our wait began
+    __atomic_fetch_add(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_SEQ_CST);
+
+    mutex_unlock(mutex);
+    int32_t ret = futex_wait(&cond->seq, seq, timeout);
+    __atomic_fetch_sub(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+
+    // Other waiters may be asleep on the mutex by now, hence the contended
+    // state, see `mutex_lock`
+    while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE)) {
+        futex_wait(&mutex->state, 2, NULL);
+    }
+
+    return ret == FUTEX_TIMEDOUT ? -1 : 0;
+}
+
+void cond_wait(cond_t* cond, mutex_t* mutex) {
+    cond_timedwait(cond, mutex, NULL);
+}
+
+static void cond_wake(cond_t* cond, uint32_t num) {
+    __atomic_fetch_add(&cond->seq, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST)) {
+        futex_wake(&cond->seq, num);
+    }
+}
+
+void cond_signal(cond_t* cond) {
+    cond_wake(cond, 1);
+}
+
+void cond_broadcast(cond_t* cond) {
+    cond_wake(cond, UINT32_MAX);
+}
@@ -0,0 +1,10 @@
+#include "libc/syscall.h"
+#include "libc/thread.h"
+
+int32_t futex_wait(volatile uint32_t* addr, uint32_t val, const timespec_t* timeout) {
+    return syscall3(SYS_FUTEX_WAIT, (uintptr_t) addr, val, (uintptr_t) timeout);
+}
+
+int32_t futex_wake(volatile uint32_t* addr, uint32_t num) {
+    return syscall2(SYS_FUTEX_WAKE, (uintptr_t) addr, num);
+}
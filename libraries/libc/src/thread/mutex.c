@@ -0,0 +1,37 @@
+#include "libc/thread.h"
+
+// Times a contended lock is polled before sleeping, in case its holder is
+// about to release it
+#define MUTEX_SPINS 100
+
+void mutex_init(mutex_t* mutex) {
+    mutex->state = 0;
+}
+
+bool mutex_trylock(mutex_t* mutex) {
+    uint32_t expected = 0;
+
+    return __atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_lock(mutex_t* mutex) {
+    for (uint32_t i = 0; i < MUTEX_SPINS; i++) {
+        if (mutex_trylock(mutex)) {
+            return;
+        }
+
+        asm volatile("pause");
+    }
+
+    // Mark the lock as contended, so that its holder wakes us up. We may
+    // mark it needlessly when we get it, which only costs a system call.
+    while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE)) {
+        futex_wait(&mutex->state, 2, NULL);
+    }
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    if (__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2) {
+        futex_wake(&mutex->state, 1);
+    }
+}
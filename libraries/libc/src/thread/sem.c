@@ -0,0 +1,48 @@
+#include "libc/syscall.h"
+#include "libc/thread.h"
+
+void sem_init(sem_t* sem, uint32_t value) {
+    sem->value = value;
+    sem->waiters = 0;
+}
+
+bool sem_trywait(sem_t* sem) {
+    uint32_t value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+
+    while (value) {
+        if (__atomic_compare_exchange_n(&sem->value, &value, value - 1, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int sem_timedwait(sem_t* sem, const timespec_t* timeout) {
+    while (!sem_trywait(sem)) {
+        // Registered before the kernel checks the value: a poster that misses
+        // us made it positive first, and the kernel won't let us sleep
+        __atomic_fetch_add(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+        int32_t ret = futex_wait(&sem->value, 0, timeout);
+        __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+
+        if (ret == FUTEX_TIMEDOUT) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void sem_wait(sem_t* sem) {
+    sem_timedwait(sem, NULL);
+}
+
+void sem_post(sem_t* sem) {
+    __atomic_fetch_add(&sem->value, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST)) {
+        futex_wake(&sem->value, 1);
+    }
+}
@@ -0,0 +1,8 @@
+#include "libc/syscall.h"
+#include "libc/thread.h"
+
+int tcb_set(tcb_t* tcb) {
+    tcb->self = tcb;
+
+    return (int32_t) syscall1(SYS_SET_THREAD_AREA, (uintptr_t) tcb);
+}
@@ -6,22 +6,58 @@ align 4
 global _start
 
 _start:
-    mov esi, prt          ; ESI points to start of string
+    ; Queue one putchar per character in a system call ring, then print the
+    ; whole string with a single system call
+    mov eax, 8            ; syscall number (ring setup)
+    mov ebx, 32           ; submission entries, more than the string needs
+    xor ecx, ecx          ; flags
+    int 0x30
 
-print_loop:
-    mov bl, [esi]         ; load one byte (character)
-    cmp bl, 0             ; check if null terminator (end of string)
-    je done               ; if yes, jump to done
+    mov ebx, eax          ; EBX points to the ring header
+    mov edx, [ebx + 4]    ; EDX = submission tail
+    mov edi, prt          ; EDI points to start of string
 
-    mov eax, 2            ; syscall number (print char)
-    int 0x30              ; interrupt (your OS-specific syscall)
+queue_loop:
+    movzx eax, byte [edi] ; load one byte (character)
+    cmp eax, 0            ; check if null terminator (end of string)
+    je submit             ; if yes, submit everything
 
-    inc esi               ; move to next character
-    jmp print_loop        ; repeat
+    ; ECX = ring + sq_offset + (tail & (sq_entries - 1)) * 32
+    mov ecx, [ebx + 16]
+    dec ecx
+    and ecx, edx
+    shl ecx, 5
+    add ecx, [ebx + 24]
+    add ecx, ebx
 
-done:
-hang:
-    jmp hang              ; infinite loop, because this is last process
+    mov dword [ecx], 2    ; syscall number (print char)
+    mov [ecx + 8], eax    ; first argument, the character
+
+    inc edx
+    inc edi               ; move to next character
+    jmp queue_loop        ; repeat
+
+submit:
+    mov [ebx + 4], edx    ; publish the new submission tail
+
+    ; SYSENTER is only set up when CPUID reports it (SEP, bit 11 of EDX)
+    mov eax, 1
+    cpuid
+    mov edi, edx
 
+    mov eax, 9            ; syscall number (ring enter)
+    xor ebx, ebx          ; run everything queued
+    test edi, 1 << 11
+    jz .slow
+
+    mov ebp, esp          ; fast syscall: user stack
+    mov esi, .ret         ; and return address
+    sysenter
+
+.slow:
+    int 0x30
+.ret:
+
+done:
     mov eax, 1            ; syscall number (exit)
     int 0x30              ; exit program